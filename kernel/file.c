@@ -10,19 +10,89 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
 #include "stat.h"
 #include "proc.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
+
+// files come from a slab cache, so there is no limit on
+// them but memory. ftable.lock protects their ref counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct slabcache cache;
 } ftable;
 
+static struct slabcache fdtcache;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  slabinit(&ftable.cache, "file", sizeof(struct file));
+  slabinit(&fdtcache, "fdtable", sizeof(struct fdtable));
+}
+
+// Allocate an empty descriptor table, or return 0.
+struct fdtable*
+fdtalloc(void)
+{
+  struct fdtable *t;
+
+  if((t = slaballoc(&fdtcache)) == 0)
+    return 0;
+  memset(t, 0, sizeof(*t));
+  initlock(&t->lock, "fdtable");
+  t->ref = 1;
+  return t;
+}
+
+// A new descriptor table with the same open files as t,
+// for fork(). Returns 0 if out of memory.
+struct fdtable*
+fdtcopy(struct fdtable *t)
+{
+  struct fdtable *nt;
+
+  if((nt = fdtalloc()) == 0)
+    return 0;
+  acquire(&t->lock);
+  for(int fd = 0; fd < NOFILE; fd++)
+    if(t->ofile[fd])
+      nt->ofile[fd] = filedup(t->ofile[fd]);
+  release(&t->lock);
+  return nt;
+}
+
+// Take another reference to t, for a thread that shares it.
+struct fdtable*
+fdtdup(struct fdtable *t)
+{
+  acquire(&t->lock);
+  t->ref++;
+  release(&t->lock);
+  return t;
+}
+
+// Drop a reference to t. The last one closes its files
+// and frees it, so may sleep unless t is empty.
+void
+fdtclose(struct fdtable *t)
+{
+  int ref;
+
+  acquire(&t->lock);
+  ref = --t->ref;
+  release(&t->lock);
+  if(ref > 0)
+    return;
+
+  for(int fd = 0; fd < NOFILE; fd++)
+    if(t->ofile[fd])
+      fileclose(t->ofile[fd]);
+  freelock(&t->lock);
+  slabfree(&fdtcache, t);
 }
 
 // Allocate a file structure.
@@ -31,16 +101,12 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = slaballoc(&ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  initsleeplock(&f->lock, "file");
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +135,9 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  freesleeplock(&f->lock);
+  slabfree(&ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -91,9 +157,9 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, &st);
-    iunlock(f->ip);
+    iunlockshared(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
       return -1;
     return 0;
@@ -111,6 +177,7 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  mmapprefault(addr, n, 1);
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -118,10 +185,14 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
+    // other readers of the inode can proceed in parallel,
+    // but not other readers of f, since they share f->off.
+    acquiresleep(&f->lock);
+    ilockshared(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
-    iunlock(f->ip);
+    iunlockshared(f->ip);
+    releasesleep(&f->lock);
   } else {
     panic("fileread");
   }
@@ -129,16 +200,64 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// write at most this many bytes per log transaction:
+// a file write may log an allocation block as well as
+// each data block, plus the i-node, an indirect block,
+// and 2 blocks of slop for non-aligned writes.
+#define MAXWRITE (((BIGOPBLOCKS-1-1-2) / 2) * BSIZE)
+
+// Log blocks to reserve for writing n <= MAXWRITE bytes.
+static int
+writeblocks(int n)
+{
+  int nb = 1 + 1 + 2 + 2*((n + BSIZE - 1) / BSIZE);
+  return nb < MAXOPBLOCKS ? MAXOPBLOCKS : nb;
+}
+
+// Write n bytes from addr to ip at *off, advancing *off
+// as the data goes out. addr is a user virtual address
+// if user is 1, otherwise a kernel address.
+static int
+inodewrite(struct inode *ip, int user, uint64 addr, int n, uint *off)
+{
+  int r = 0;
+
+  // write in chunks to avoid exceeding the maximum log
+  // transaction size. this really belongs lower down,
+  // since writei() might be writing a device like the console.
+  int i = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > MAXWRITE)
+      n1 = MAXWRITE;
+
+    begin_opn(writeblocks(n1));
+    ilock(ip);
+    if ((r = writei(ip, user, addr + i, *off, n1)) > 0)
+      *off += r;
+    iunlock(ip);
+    end_opn(writeblocks(n1));
+
+    if(r != n1){
+      // error from writei
+      break;
+    }
+    i += r;
+  }
+  return i == n ? n : -1;
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
+  mmapprefault(addr, n, 0);
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -146,37 +265,187 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
+    ret = inodewrite(f->ip, 1, addr, n, &f->off);
+  } else {
+    panic("filewrite");
+  }
+
+  return ret;
+}
+
+// Read from inode file f at offset off, leaving f->off
+// alone, so needing only a shared lock on the inode.
+// addr is a user virtual address.
+int
+filepread(struct file *f, uint64 addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
 
+  mmapprefault(addr, n, 1);
+  ilockshared(f->ip);
+  r = readi(f->ip, 1, addr, off, n);
+  iunlockshared(f->ip);
+  return r;
+}
+
+// Write to inode file f at offset off, leaving f->off alone.
+// addr is a user virtual address.
+int
+filepwrite(struct file *f, uint64 addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+
+  mmapprefault(addr, n, 0);
+  return inodewrite(f->ip, 1, addr, n, &off);
+}
+
+// Read n bytes of f at off into kernel memory at pa,
+// for a page of a mapping of f. Reads stop at end of file.
+int
+fileload(struct file *f, uint64 pa, int n, uint off)
+{
+  int r;
+
+  ilockshared(f->ip);
+  r = readi(f->ip, 0, pa, off, n);
+  iunlockshared(f->ip);
+  return r;
+}
+
+// Write n bytes of kernel memory at pa back to f at off,
+// for a page of a shared mapping of f. Doesn't extend
+// the file, since a mapping's last page runs past its end.
+int
+filestore(struct file *f, uint64 pa, int n, uint off)
+{
+  uint size;
+
+  ilockshared(f->ip);
+  size = f->ip->size;
+  iunlockshared(f->ip);
+  if(off >= size)
+    return 0;
+  if(n > size - off)
+    n = size - off;
+  return inodewrite(f->ip, 0, pa, n, &off);
+}
+
+// Read from file f into the n buffers in iov, in order.
+// Reads of an inode stop at end of file; other kinds
+// of file return after the first buffer that gets data,
+// rather than wait for more.
+// iov is a kernel copy; its buffers are user addresses.
+int
+filereadv(struct file *f, struct iovec *iov, int n)
+{
+  int i, r, tot = 0;
+
+  if(f->readable == 0)
+    return -1;
+
+  if(f->type != FD_INODE){
+    for(i = 0; i < n; i++){
+      if(iov[i].iov_len == 0)
+        continue;
+      return fileread(f, (uint64)iov[i].iov_base, iov[i].iov_len);
+    }
+    return 0;
+  }
+
+  for(i = 0; i < n; i++)
+    mmapprefault((uint64)iov[i].iov_base, iov[i].iov_len, 1);
+  acquiresleep(&f->lock);
+  ilockshared(f->ip);
+  for(i = 0; i < n; i++){
+    if((r = readi(f->ip, 1, (uint64)iov[i].iov_base, f->off, iov[i].iov_len)) < 0){
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    f->off += r;
+    tot += r;
+    if(r < iov[i].iov_len)
+      break;
+  }
+  iunlockshared(f->ip);
+  releasesleep(&f->lock);
+
+  return tot;
+}
+
+// Write the n buffers in iov to file f, in order.
+// An inode's writes share log transactions across
+// buffers, rather than starting one per buffer.
+// iov is a kernel copy; its buffers are user addresses,
+// whose lengths add up to at most INT_MAX.
+// Returns the bytes written, or -1 if an error stopped
+// it before any were.
+int
+filewritev(struct file *f, struct iovec *iov, int n)
+{
+  int i, r, n1, off, room, nb, tot = 0, left;
+
+  if(f->writable == 0)
+    return -1;
+
+  if(f->type != FD_INODE){
+    for(i = 0; i < n; i++){
+      if(iov[i].iov_len == 0)
+        continue;
+      if((r = filewrite(f, (uint64)iov[i].iov_base, iov[i].iov_len)) > 0)
+        tot += r;
+      if(r != iov[i].iov_len)
+        return tot > 0 ? tot : -1;
+    }
+    return tot;
+  }
+
+  for(i = 0; i < n; i++)
+    tot += iov[i].iov_len;
+
+  // bytes written to a transaction are contiguous in
+  // the file, so they need no more log space than a
+  // single write of the same size.
+  for(i = 0; i < n; i++)
+    mmapprefault((uint64)iov[i].iov_base, iov[i].iov_len, 0);
+  left = tot;
+  room = left < MAXWRITE ? left : MAXWRITE;
+  nb = writeblocks(room);
+  begin_opn(nb);
+  ilock(f->ip);
+  for(i = 0; i < n; i++){
+    for(off = 0; off < iov[i].iov_len; off += r){
+      if(room == 0){
+        iunlock(f->ip);
+        end_opn(nb);
+        room = left < MAXWRITE ? left : MAXWRITE;
+        nb = writeblocks(room);
+        begin_opn(nb);
+        ilock(f->ip);
+      }
+      n1 = iov[i].iov_len - off;
+      if(n1 > room)
+        n1 = room;
+      if((r = writei(f->ip, 1, (uint64)iov[i].iov_base + off, f->off, n1)) > 0)
+        f->off += r;
       if(r != n1){
         // error from writei
-        break;
+        tot -= left - (r > 0 ? r : 0);
+        if(tot == 0)
+          tot = -1;
+        goto out;
       }
-      i += r;
+      room -= r;
+      left -= r;
     }
-    ret = (i == n ? n : -1);
-  } else {
-    panic("filewrite");
   }
+out:
+  iunlock(f->ip);
+  end_opn(nb);
 
-  return ret;
+  return tot;
 }
-
@@ -0,0 +1,158 @@
+//
+// futexes: lets threads sleep until a word of the memory
+// they share changes, so that user-level locks need not spin.
+// a waiter is known by the physical address of the word it
+// waits on, hashed to one of NBUCKET wait queues, so that
+// processes sharing a MAP_SHARED page can wake each other
+// as well as threads can.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "proc.h"
+
+#define NBUCKET 31
+
+// on the kernel stack of a thread in futexwait().
+struct waiter {
+  uint64 pa;
+  struct proc *p;
+  int woken;
+  struct waiter *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct waiter *head;
+} bucket[NBUCKET];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NBUCKET; i++)
+    initlock(&bucket[i].lock, "futex");
+}
+
+static int
+hash(uint64 pa)
+{
+  return (pa >> 2) % NBUCKET;
+}
+
+// The physical address of the int at user address va of
+// the current process, or 0 if it isn't mapped. The caller
+// has called push_off(), and uses the address before
+// pop_off(), so that tlbshootdown() can't free its page.
+static uint64
+wordaddr(uint64 va)
+{
+  uint64 pa;
+
+  if((pa = walkaddr(myproc()->pagetable, va)) == 0)
+    return 0;
+  return pa + (va - PGROUNDDOWN(va));
+}
+
+// unlink w from the queue of b, if it's there.
+static void
+dequeue(int b, struct waiter *w)
+{
+  struct waiter **wp;
+
+  for(wp = &bucket[b].head; *wp; wp = &(*wp)->next){
+    if(*wp == w){
+      *wp = w->next;
+      break;
+    }
+  }
+}
+
+// If the int at user address va still holds val, sleep
+// until futexwake(va) or a kill. Returns 0, or -1 if va
+// is not a mapped, aligned user address or the thread
+// was killed.
+int
+futexwait(uint64 va, int val)
+{
+  struct proc *p = myproc();
+  struct waiter w;
+  uint64 pa;
+  int b;
+
+  if(va % sizeof(int) != 0)
+    return -1;
+
+  // the word is read with the bucket locked, so that
+  // faulting it in can't sleep.
+  mmapprefault(va, sizeof(int), 0);
+
+  push_off();
+  if((pa = wordaddr(va)) == 0){
+    pop_off();
+    return -1;
+  }
+  b = hash(pa);
+  acquire(&bucket[b].lock);
+  pop_off();  // the bucket lock keeps interrupts off.
+
+  // a waker changes the word before it takes the bucket
+  // lock, so if it is unchanged here, the wakeup is yet
+  // to come and will find w on the queue.
+  if(__atomic_load_n((int*)pa, __ATOMIC_SEQ_CST) != val){
+    release(&bucket[b].lock);
+    return 0;
+  }
+
+  w.pa = pa;
+  w.p = p;
+  w.woken = 0;
+  w.next = bucket[b].head;
+  bucket[b].head = &w;
+  while(!w.woken && !killed(p))
+    sleep(&w, &bucket[b].lock);
+  if(!w.woken)
+    dequeue(b, &w);
+  release(&bucket[b].lock);
+
+  return w.woken ? 0 : -1;
+}
+
+// Wake up to n threads waiting on user address va.
+// Returns the number woken.
+int
+futexwake(uint64 va, int n)
+{
+  struct waiter *w, **wp;
+  uint64 pa;
+  int b, woken = 0;
+
+  if(va % sizeof(int) != 0)
+    return 0;
+  mmapprefault(va, sizeof(int), 0);
+
+  push_off();
+  if((pa = wordaddr(va)) == 0){
+    pop_off();
+    return 0;
+  }
+  b = hash(pa);
+  acquire(&bucket[b].lock);
+  pop_off();
+  for(wp = &bucket[b].head; *wp && woken < n; ){
+    w = *wp;
+    if(w->pa == pa){
+      *wp = w->next;
+      w->woken = 1;
+      wakeproc(w->p, w);
+      woken++;
+    } else {
+      wp = &w->next;
+    }
+  }
+  release(&bucket[b].lock);
+
+  return woken;
+}
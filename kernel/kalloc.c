@@ -1,6 +1,17 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or blocks of 2^order contiguous pages, up to the
+// 2-megabyte frames of megapage mappings.
+//
+// A buddy allocator: a free block of 2^k pages is aligned
+// to its size, and on kfree joins its buddy, the other half
+// of the block of 2^(k+1) pages they came from, whenever
+// that is free too. Allocation splits the smallest big
+// enough free block, putting the unused halves back.
+//
+// Idle harts keep a pool of up to NZEROED pages zeroed in
+// advance, for kalloc_zeroed().
 
 #include "types.h"
 #include "param.h"
@@ -16,11 +27,22 @@ extern char end[]; // first address after kernel.
 
 struct run {
   struct run *next;
+  struct run *prev;  // only for free blocks
 };
 
+// index of the page at pa in kmem.ref and kmem.order.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+#define REF2PA(i) (KERNBASE + (uint64)(i) * PGSIZE)
+
+#define NPAGE PA2REF(PHYSTOP)
+
 struct {
   struct spinlock lock;
-  struct run *freelist;
+  struct run *free[MAXORDER+1]; // free blocks of each order
+  struct run *zerolist;      // zeroed pages, not counted as free
+  int nzeroed;               // pages on zerolist
+  int ref[NPAGE];            // page table mappings etc. of each page
+  char order[NPAGE];         // 1 + order of a free block starting here
 } kmem;
 
 void
@@ -35,31 +57,168 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kmem.ref[PA2REF(p)] = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
-void
-kfree(void *pa)
+static void
+listadd(int k, struct run *r)
+{
+  r->prev = 0;
+  r->next = kmem.free[k];
+  if(r->next)
+    r->next->prev = r;
+  kmem.free[k] = r;
+  kmem.order[PA2REF(r)] = k + 1;
+}
+
+static void
+listdel(int k, struct run *r)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.free[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.order[PA2REF(r)] = 0;
+}
+
+// Put the free block of 2^k pages at r on a free list,
+// first joining it with its buddy for as long as that is
+// free as well. Caller must hold kmem.lock.
+static void
+freeblock(struct run *r, int k)
+{
+  uint64 i, b;
+
+  i = PA2REF(r);
+  for(; k < MAXORDER; k++){
+    b = i ^ (1L << k);
+    if(b >= NPAGE || kmem.order[b] != k + 1)
+      break;
+    listdel(k, (struct run*)REF2PA(b));
+    i &= ~(1L << k);
+  }
+  listadd(k, (struct run*)REF2PA(i));
+}
+
+// Take a free block of 2^order pages, splitting a block of
+// at most 2^maxorder pages if there is none of the right
+// size. Leaves the block's ref to the caller.
+// Caller must hold kmem.lock.
+static struct run*
+takeblock(int order, int maxorder)
 {
   struct run *r;
+  int k;
+
+  for(k = order; k <= maxorder && kmem.free[k] == 0; k++)
+    ;
+  if(k > maxorder)
+    return 0;
+  r = kmem.free[k];
+  listdel(k, r);
+  // give back the upper halves.
+  while(k > order){
+    k--;
+    listadd(k, (struct run*)((char*)r + (PGSIZE << k)));
+  }
+  return r;
+}
 
+// Take another reference to the allocated page at pa,
+// for instance to map it into a second page table.
+// Each reference is dropped with kfree().
+void
+kref(void *pa)
+{
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kref");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] < 1)
+    panic("kref: free page");
+  kmem.ref[PA2REF(pa)]++;
+  release(&kmem.lock);
+}
+
+// Drop a reference to the block of 2^order pages of physical
+// memory at pa, and free it if that was the last one. The
+// block normally should have been returned by a call to
+// kallocpages(order), or to kalloc() if order is 0.
+// (The exception is when initializing the allocator;
+// see kinit above.)
+void
+kfreepages(void *pa, int order)
+{
+  int ref;
+
+  if(order < 0 || order > MAXORDER || ((uint64)pa % (PGSIZE << order)) != 0 ||
+     (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  acquire(&kmem.lock);
+  if((ref = --kmem.ref[PA2REF(pa)]) < 0)
+    panic("kfree: free page");
+  release(&kmem.lock);
+  if(ref > 0)
+    return;
+
+#ifndef NOJUNK
   // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  memset(pa, 1, PGSIZE << order);
+#endif
 
-  r = (struct run*)pa;
+  acquire(&kmem.lock);
+  freeblock((struct run*)pa, order);
+  release(&kmem.lock);
+}
+
+// Drop a reference to a page returned by kalloc().
+void
+kfree(void *pa)
+{
+  kfreepages(pa, 0);
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Returns 0 if there is no such block free.
+void *
+kallocpages(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
 
   acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  r = takeblock(order, MAXORDER);
+  if(r)
+    kmem.ref[PA2REF(r)] = 1;
   release(&kmem.lock);
+
+#ifndef NOJUNK
+  if(r)
+    memset((char*)r, 5, PGSIZE << order); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Take a page off the zeroed pool. Caller must hold kmem.lock.
+static struct run*
+takezeroed(void)
+{
+  struct run *r;
+
+  r = kmem.zerolist;
+  if(r){
+    kmem.zerolist = r->next;
+    kmem.nzeroed--;
+  }
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -71,12 +230,122 @@ kalloc(void)
   struct run *r;
 
   acquire(&kmem.lock);
-  r = kmem.freelist;
+  if((r = takeblock(0, MAXORDER)) == 0 && (r = takezeroed()) != 0){
+    // out of other pages; no point filling this one.
+    kmem.ref[PA2REF(r)] = 1;
+    release(&kmem.lock);
+    return (void*)r;
+  }
   if(r)
-    kmem.freelist = r->next;
+    kmem.ref[PA2REF(r)] = 1;
   release(&kmem.lock);
 
+#ifndef NOJUNK
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
+
+// Allocate a page like kalloc(), but filled with zeros,
+// preferably one the idle loop already cleared.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = takezeroed();
+  if(r)
+    kmem.ref[PA2REF(r)] = 1;
+  release(&kmem.lock);
+
+  if(r){
+    r->next = 0;  // the only non-zero word
+    return (void*)r;
+  }
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
+  return (void*)r;
+}
+
+// Called by the scheduler when it finds nothing to run: zero
+// one free page for the pool, unless the pool is full or free
+// pages have run out. Doesn't break up whole free frames, so
+// as not to use up megapages. Returns 1 if it zeroed a page.
+int
+kzero(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = 0;
+  if(kmem.nzeroed < NZEROED)
+    r = takeblock(0, MAXORDER - 1);
+  release(&kmem.lock);
+  if(r == 0)
+    return 0;
+
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  kmem.nzeroed++;
+  release(&kmem.lock);
+  return 1;
+}
+
+// Allocate a SUPERPGSIZE-aligned frame of SUPERPGSIZE bytes,
+// for a megapage. Unlike kallocpages(), doesn't fill it.
+// Returns 0 if there is no free frame.
+void *
+superalloc(void)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  r = takeblock(MAXORDER, MAXORDER);
+  if(r)
+    kmem.ref[PA2REF(r)] = 1;
+  release(&kmem.lock);
+
+  // no junk fill; callers zero or copy the whole frame.
+  return (void*)r;
+}
+
+// Free a frame returned by superalloc().
+void
+superfree(void *pa)
+{
+  if(((uint64)pa % SUPERPGSIZE) != 0 || (char*)pa < end ||
+     (uint64)pa >= PHYSTOP)
+    panic("superfree");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] != 1)
+    panic("superfree: ref");
+  kmem.ref[PA2REF(pa)] = 0;
+  freeblock((struct run*)pa, MAXORDER);
+  release(&kmem.lock);
+}
+
+// Turn a frame returned by superalloc() into SUPERPGSIZE/PGSIZE
+// pages, each to be freed with kfree(). The frame becomes free
+// again once all of them are.
+void
+ksplit(void *pa)
+{
+  int i;
+
+  if(((uint64)pa % SUPERPGSIZE) != 0 || (char*)pa < end ||
+     (uint64)pa >= PHYSTOP)
+    panic("ksplit");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[PA2REF(pa)] != 1)
+    panic("ksplit: ref");
+  for(i = 1; i < SUPERPGSIZE/PGSIZE; i++)
+    kmem.ref[PA2REF(pa) + i] = 1;
+  release(&kmem.lock);
+}
@@ -20,6 +20,9 @@
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// begin_op() reserves MAXOPBLOCKS of log space; a call
+// that writes more, like a large file write, uses
+// begin_opn()/end_opn() to reserve what it needs.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -29,6 +32,15 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// If the kernel is built with ORDERED, file data written
+// with log_write_data() skips the log. Instead, commit()
+// writes it to its home location before the header write
+// that commits the metadata pointing at it, so data goes
+// to disk once rather than twice. A block freed earlier in
+// the same transaction is still logged, since if the
+// transaction never commits the block still belongs to its
+// old file.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,9 +54,14 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks reserved by outstanding calls.
   int committing;  // in commit(), please wait.
   int dev;
   struct logheader lh;
+  int ndata;       // ordered data blocks, pinned, not in lh.
+  int data[LOGSIZE];
+  int nfreed;      // blocks freed in this transaction,
+  int freed[LOGSIZE]; // or -1 if there were too many to track.
 };
 struct log log;
 
@@ -126,15 +143,26 @@ recover_from_log(void)
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// start an FS operation that may write up to n blocks.
+void
+begin_opn(int n)
+{
+  if(n < 1 || n > BIGOPBLOCKS)
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.ndata + log.reserved + n > LOGSIZE){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
       release(&log.lock);
       break;
     }
@@ -145,11 +173,19 @@ begin_op(void)
 // commits if this was the last outstanding operation.
 void
 end_op(void)
+{
+  end_opn(MAXOPBLOCKS);
+}
+
+// end an operation started by begin_opn(n).
+void
+end_opn(int n)
 {
   int do_commit = 0;
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= n;
   if(log.committing)
     panic("log.committing");
   if(log.outstanding == 0){
@@ -190,9 +226,25 @@ write_log(void)
   }
 }
 
+// Write ordered data blocks to their home locations.
+static void
+write_data(void)
+{
+  int i;
+
+  for (i = 0; i < log.ndata; i++) {
+    struct buf *b = bread(log.dev, log.data[i]);
+    bwrite(b);
+    bunpin(b);
+    brelse(b);
+  }
+  log.ndata = 0;
+}
+
 static void
 commit()
 {
+  write_data();      // Data first, so committed metadata never points at junk
   if (log.lh.n > 0) {
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
@@ -200,6 +252,19 @@ commit()
     log.lh.n = 0;
     write_head();    // Erase the transaction from the log
   }
+  log.nfreed = 0;
+}
+
+// Index of blockno in a[0..n-1], or n.
+static int
+find(int *a, int n, int blockno)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (a[i] == blockno)
+      break;
+  return i;
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -222,10 +287,15 @@ log_write(struct buf *b)
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
-      break;
+  // an ordered data block that now holds metadata,
+  // like a fresh directory block, moves to the log.
+  i = find(log.data, log.ndata, b->blockno);
+  if (i < log.ndata) {
+    log.data[i] = log.data[--log.ndata];
+    bunpin(b);
   }
+
+  i = find(log.lh.block, log.lh.n, b->blockno);  // log absorption
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
@@ -234,3 +304,47 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+// Like log_write(), but for a file's data block,
+// which in ORDERED mode need not go through the log.
+void
+log_write_data(struct buf *b)
+{
+#ifdef ORDERED
+  int i;
+
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_write_data outside of trans");
+  if (find(log.lh.block, log.lh.n, b->blockno) == log.lh.n &&
+      log.nfreed >= 0 && find(log.freed, log.nfreed, b->blockno) == log.nfreed) {
+    i = find(log.data, log.ndata, b->blockno);
+    if (i < log.ndata) {
+      release(&log.lock);
+      return;
+    }
+    if (log.ndata < LOGSIZE) {
+      log.data[log.ndata++] = b->blockno;
+      bpin(b);
+      release(&log.lock);
+      return;
+    }
+  }
+  release(&log.lock);
+#endif
+  log_write(b);
+}
+
+// Note that the current transaction frees blockno.
+void
+log_free(int blockno)
+{
+  acquire(&log.lock);
+  if (log.nfreed >= 0) {
+    if (log.nfreed < LOGSIZE)
+      log.freed[log.nfreed++] = blockno;
+    else
+      log.nfreed = -1;
+  }
+  release(&log.lock);
+}
+
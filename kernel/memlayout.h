@@ -27,6 +27,7 @@
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid)) // interrupts hartid in machine mode.
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -59,6 +60,27 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mmap()ed files, growing down from MMAPTOP
+//   USHARED (one page shared by all processes, read-only)
+//   USYSCALL (p->usyscall, read-only)
+//   THREADFRAME(1..NTHREAD-1) (trapframes of clone()d threads)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define THREADFRAME(t) (TRAPFRAME - (t)*PGSIZE)
+#define USYSCALL  (THREADFRAME(NTHREAD-1) - PGSIZE)
+#define USHARED   (USYSCALL - PGSIZE)
+#define MMAPTOP   USHARED
+
+#ifndef __ASSEMBLER__
+// lets user code read per-process state without a system call.
+struct usyscall {
+  int pid;  // Process ID
+};
+
+// system-wide state for user code; see uuptime() in ulib.c.
+struct ushared {
+  uint ticks;       // ticks since boot, if interval is 0
+  uint64 interval;  // else time CSR units per tick
+};
+#endif
@@ -1,13 +1,20 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC        64  // processes per chunk of the process table
+#define MAXPROC    1024  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define MAXOPBLOCKS  10  // max # of blocks an FS op writes, unless it asks for more
+#define BIGOPBLOCKS  60  // max # of blocks one op may ask for
+#define LOGSIZE      (BIGOPBLOCKS*2)  // max data blocks in on-disk log
+#define NBUF         (LOGSIZE+MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define NVMA         16  // file mappings per process
+#define NTHREAD       8  // threads per process, counting the first
+#define NZEROED      64  // pre-zeroed free pages kept by idle harts
+#define NMAG         16  // free objects each CPU keeps per slab cache
+#define NLOCK       500  // maximum number of locks of each kind in statistics
+#define BACKOFF      64  // spin loop iterations per waiter ahead in a lock queue
+#define TICKINTERVAL 1000000 // cycles per clock tick; about 1/10th second in qemu
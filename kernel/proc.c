@@ -4,11 +4,19 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
+// The process table grows by chunks of NPROC procs, up to
+// MAXPROC, when allocproc() finds no UNUSED proc. Chunks are
+// never freed, so a struct proc, its kernel stack and its ASID
+// stay put once they exist.
+static struct proc *chunks[MAXPROC/NPROC];
+static int nproc;               // procs in the table
+static struct proc *freeprocs;  // UNUSED procs
+static struct spinlock proc_lock; // protects the above
 
 struct proc *initproc;
 
@@ -19,6 +27,7 @@ extern void forkret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
+extern pagetable_t kernel_pagetable; // vm.c
 
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
@@ -26,36 +35,90 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl)
+// the proc with index i in the table.
+static struct proc*
+procat(int i)
 {
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  return &chunks[i / NPROC][i % NPROC];
+}
+
+// the proc after p in the table, or the first if p is 0.
+// returns 0 after the last.
+static struct proc*
+procnext(struct proc *p)
+{
+  int i = p ? p->idx + 1 : 0;
+
+  if(i >= __atomic_load_n(&nproc, __ATOMIC_ACQUIRE))
+    return 0;
+  return procat(i);
+}
+
+// Add a chunk of NPROC procs to the table, each with a
+// kernel stack mapped high in memory, followed by an invalid
+// guard page. Returns 0, or -1 if the table is full or
+// memory is short. Caller must hold proc_lock.
+static int
+procgrow(void)
+{
+  struct proc *c, *p;
+  struct sleeplock *mm;
+  uint64 sz = NPROC * (sizeof(struct proc) + sizeof(struct sleeplock));
+  char *pa;
+  int i, order;
+
+  if(nproc == MAXPROC)
+    return -1;
+  for(order = 0; (PGSIZE << order) < sz; order++)
+    ;
+  if((c = kallocpages(order)) == 0)
+    return -1;
+  memset(c, 0, sz);
+  mm = (struct sleeplock*)&c[NPROC];
+  for(i = 0; i < NPROC; i++){
+    p = &c[i];
+    p->idx = nproc + i;
+    p->kstack = KSTACK(p->idx);
+    if((pa = kalloc()) == 0 ||
+       mappages(kernel_pagetable, p->kstack, PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0){
+      if(pa)
+        kfree(pa);
+      while(--i >= 0){
+        uvmunmap(kernel_pagetable, c[i].kstack, 1, 1);
+        freesleeplock(c[i].mmlock);
+        freelock(&c[i].lock);
+      }
+      kfreepages(c, order);
+      return -1;
+    }
+    initlock(&p->lock, "proc");
+    initsleeplock(&mm[i], "mm");
+    p->mmlock = &mm[i];
+    p->state = UNUSED;
+  }
+  for(i = NPROC-1; i >= 0; i--){
+    c[i].nextfree = freeprocs;
+    freeprocs = &c[i];
   }
+  // this hart will switch to the new kernel stacks; the
+  // scheduler flushes other harts' TLBs when nproc grows.
+  sfence_vma();
+  chunks[nproc / NPROC] = c;
+  __atomic_store_n(&nproc, nproc + NPROC, __ATOMIC_RELEASE);
+  return 0;
 }
 
 // initialize the proc table.
 void
 procinit(void)
 {
-  struct proc *p;
-  
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  initlock(&proc_lock, "proc_lock");
+  acquire(&proc_lock);
+  if(procgrow() < 0)
+    panic("procinit");
+  release(&proc_lock);
 }
 
 // Must be called with interrupts disabled,
@@ -102,28 +165,33 @@ allocpid()
   return pid;
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
+// Take an UNUSED proc, growing the process table if there is
+// none, initialize state required to run in the kernel,
 // and return with p->lock held.
+// A thread gets no page table of its own; clone() gives it its leader's.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(int thread)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  acquire(&proc_lock);
+  if(freeprocs == 0 && procgrow() < 0){
+    release(&proc_lock);
+    return 0;
   }
-  return 0;
+  p = freeprocs;
+  freeprocs = p->nextfree;
+  release(&proc_lock);
 
-found:
+  acquire(&p->lock);
   p->pid = allocpid();
   p->state = USED;
+  p->leader = p;
+  p->tslot = 0;
+  // the last process in this slot had the same ASID.
+  p->tlbstale = ~0L;
+  p->ucpa = 0;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -132,14 +200,29 @@ found:
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if(p->pagetable == 0){
-    freeproc(p);
-    release(&p->lock);
-    return 0;
+  if(!thread){
+    // Allocate the page user code reads its pid from.
+    if((p->usyscall = (struct usyscall *)kalloc_zeroed()) == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    p->usyscall->pid = p->pid;
+
+    // An empty user page table.
+    p->pagetable = proc_pagetable(p);
+    if(p->pagetable == 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
   }
 
+  // Values uservec in trampoline.S loads on every trap.
+  p->trapframe->kernel_satp = r_satp();         // kernel page table
+  p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
+  p->trapframe->kernel_trap = (uint64)usertrap;
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -150,17 +233,29 @@ found:
 }
 
 // free a proc structure and the data hanging from it,
-// including user pages.
-// p->lock must be held.
+// including user pages, unless p is a thread, whose
+// leader owns them.
+// p->lock must be held, and wait_lock too if p is a thread.
 static void
 freeproc(struct proc *p)
 {
+  if(p->leader && p->leader != p){
+    uvmunmap(p->pagetable, THREADFRAME(p->tslot), 1, 0);
+    tlbstale(p);
+    p->leader->tslots &= ~(1 << p->tslot);
+    p->leader->nthread--;
+  } else if(p->pagetable){
+    proc_freepagetable(p->pagetable, p->sz);
+  }
+  p->pagetable = 0;
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
-  p->pagetable = 0;
+  if(p->usyscall)
+    kfree((void*)p->usyscall);
+  p->usyscall = 0;
+  p->leader = 0;
+  p->tslot = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
@@ -169,6 +264,11 @@ freeproc(struct proc *p)
   p->killed = 0;
   p->xstate = 0;
   p->state = UNUSED;
+
+  acquire(&proc_lock);
+  p->nextfree = freeprocs;
+  freeprocs = p;
+  release(&proc_lock);
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -202,6 +302,24 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the pages user code may read without
+  // a system call just below the trapframe.
+  if(mappages(pagetable, USYSCALL, PGSIZE,
+              (uint64)(p->usyscall), PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+  if(mappages(pagetable, USHARED, PGSIZE,
+              (uint64)ushared, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, USYSCALL, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -212,6 +330,8 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, USYSCALL, 1, 0);
+  uvmunmap(pagetable, USHARED, 1, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -234,8 +354,9 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
+  p->fdt = fdtalloc();
   
   // allocate one user page and copy initcode's instructions
   // and data into it.
@@ -261,30 +382,124 @@ growproc(int n)
 {
   uint64 sz;
   struct proc *p = myproc();
+  struct proc *pp;
 
+  lockmm(p);
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n > mmapbase(p) ||
+       (sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+      unlockmm(p);
       return -1;
     }
   } else if(n < 0){
+    // other threads may still be using the pages.
+    if(uvminval(p->pagetable, sz, sz + n) < 0){
+      unlockmm(p);
+      return -1;
+    }
+    tlbshootdown(p);
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
-  p->sz = sz;
+  // threads keep their own copy of the size.
+  for(pp = procnext(0); pp; pp = procnext(pp))
+    if(pp->leader == p->leader)
+      pp->sz = sz;
+  tlbstale(p);
+  unlockmm(p);
   return 0;
 }
 
+// The address-space ID of p's page table: one more than the
+// index of its leader in the process table, or 0, like the kernel, if the
+// hardware has too few ASIDs.
+uint64
+procasid(struct proc *p)
+{
+  if(!useasid)
+    return 0;
+  return p->leader->idx + 1;
+}
+
+// Note that p's page table has changed, so that each hart
+// flushes the TLB entries for its ASID before next running
+// one of its threads in user space, and copyin() and
+// copyout() forget the pages they have looked up.
+void
+tlbstale(struct proc *p)
+{
+  __atomic_store_n(&p->leader->tlbstale, ~0L, __ATOMIC_SEQ_CST);
+  __atomic_fetch_add(&p->leader->mmgen, 1, __ATOMIC_SEQ_CST);
+}
+
+// Make sure that no hart can still reach the pages that have
+// just been removed from p's page table, so that the caller can
+// free them: tlbstale(), then interrupt each other hart running
+// one of p's threads, and wait until it has flushed its TLB and
+// finished any copyin() or copyout() it was in the middle of.
+// Don't hold a spinlock, lest the other hart be waiting for it
+// with interrupts off.
+void
+tlbshootdown(struct proc *p)
+{
+  struct proc *l = p->leader, *q;
+  struct cpu *c, *me;
+  uint acks[NCPU];
+  uint64 wait = 0;
+  int i;
+
+  tlbstale(p);
+
+  // a hart that goes on to run one of p's threads flushes in
+  // usertrapret(), since tlbstale() has marked it.
+  push_off();
+  me = mycpu();
+  for(i = 0; i < NCPU; i++){
+    c = &cpus[i];
+    q = __atomic_load_n(&c->proc, __ATOMIC_SEQ_CST);
+    if(c == me || q == 0 || q->leader != l)
+      continue;
+    acks[i] = __atomic_load_n(&c->tlbacks, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&c->tlbflush, 1, __ATOMIC_SEQ_CST);
+    *(volatile uint32*)CLINT_MSIP(i) = 1;
+    wait |= 1L << i;
+  }
+  pop_off();
+
+  // a hart with interrupts off answers once it turns them on.
+  for(i = 0; i < NCPU; i++)
+    if(wait & (1L << i))
+      while(__atomic_load_n(&cpus[i].tlbacks, __ATOMIC_SEQ_CST) == acks[i])
+        ;
+}
+
+// Answer another hart's tlbshootdown(). Called by devintr().
+void
+tlbintr(void)
+{
+  struct cpu *c = mycpu();
+
+  if(__atomic_exchange_n(&c->tlbflush, 0, __ATOMIC_SEQ_CST)){
+    sfence_vma();
+    __atomic_fetch_add(&c->tlbacks, 1, __ATOMIC_SEQ_CST);
+  }
+}
+
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *p = myproc();
 
+  // keep p's threads from changing the memory being copied.
+  lockmm(p);
+
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
+    unlockmm(p);
     return -1;
   }
 
@@ -292,20 +507,39 @@ fork(void)
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
     freeproc(np);
     release(&np->lock);
+    unlockmm(p);
     return -1;
   }
   np->sz = p->sz;
 
+  // copy mmap()ed regions; shared ones stay shared. that may
+  // read pages in from files, so np->lock can't be held.
+  release(&np->lock);
+  if(mmapcopy(p, np) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    unlockmm(p);
+    return -1;
+  }
+  unlockmm(p);
+
+  // the child gets its own copy of the descriptor table.
+  if((np->fdt = fdtcopy(p->fdt)) == 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  acquire(&np->lock);
+
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
+  np->trapframe->kernel_sp = np->kstack + PGSIZE;
 
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
 
-  // increment reference counts on open file descriptors.
-  for(i = 0; i < NOFILE; i++)
-    if(p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
@@ -325,19 +559,135 @@ fork(void)
   return pid;
 }
 
-// Pass p's abandoned children to init.
+// Create a thread that shares the current process's memory,
+// and starts at fn(arg) on the user stack that ends at stack.
+// It shares the descriptor table, so files it opens or closes
+// are opened or closed for the whole process.
+// fn must not return; the thread ends by calling exit().
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int pid, slot;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *l = p->leader;
+
+  // pick a trapframe address no other thread of l is using.
+  acquire(&wait_lock);
+  for(slot = 1; slot < NTHREAD; slot++)
+    if((l->tslots & (1 << slot)) == 0)
+      break;
+  if(slot < NTHREAD){
+    l->tslots |= 1 << slot;
+    l->nthread++;
+  }
+  release(&wait_lock);
+  if(slot == NTHREAD)
+    return -1;
+
+  lockmm(p);
+  if((np = allocproc(1)) == 0){
+    unlockmm(p);
+    goto bad;
+  }
+  if(mappages(p->pagetable, THREADFRAME(slot), PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) != 0){
+    freeproc(np);
+    release(&np->lock);
+    unlockmm(p);
+    goto bad;
+  }
+  np->leader = l;
+  np->tslot = slot;
+  np->pagetable = p->pagetable;
+  np->sz = p->sz;
+  tlbstale(p);
+
+  // start at fn(arg), with p's gp and tp.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->kernel_sp = np->kstack + PGSIZE;
+  np->trapframe->epc = fn;
+  np->trapframe->sp = stack & ~0xfL;
+  np->trapframe->a0 = arg;
+  np->trapframe->ra = -1;  // returning from fn faults.
+
+  np->fdt = fdtdup(p->fdt);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  pid = np->pid;
+
+  release(&np->lock);
+  unlockmm(p);
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  np->state = RUNNABLE;
+  release(&np->lock);
+
+  return pid;
+
+ bad:
+  acquire(&wait_lock);
+  l->tslots &= ~(1 << slot);
+  l->nthread--;
+  release(&wait_lock);
+  return -1;
+}
+
+// Pass p's abandoned children to init, or for threads
+// to the leader of p's threads.
 // Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
+  for(pp = procnext(0); pp; pp = procnext(pp)){
     if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
+      if(pp->leader != pp){
+        pp->parent = p->leader;
+        wakeup(p->leader);
+      } else {
+        pp->parent = initproc;
+        wakeup(initproc);
+      }
+    }
+  }
+}
+
+// Kill the threads p leads, and wait for them to
+// exit, so that p's memory can be freed.
+static void
+stopthreads(struct proc *p)
+{
+  struct proc *pp;
+
+  acquire(&wait_lock);
+  while(p->nthread > 0){
+    for(pp = procnext(0); pp; pp = procnext(pp)){
+      if(pp == p || pp->leader != p)
+        continue;
+      acquire(&pp->lock);
+      if(pp->leader == p){
+        if(pp->state == ZOMBIE){
+          freeproc(pp);
+        } else {
+          pp->killed = 1;
+          if(pp->state == SLEEPING)
+            pp->state = RUNNABLE;
+        }
+      }
+      release(&pp->lock);
     }
+    if(p->nthread > 0)
+      sleep(p, &wait_lock);
   }
+  release(&wait_lock);
 }
 
 // Exit the current process.  Does not return.
@@ -351,15 +701,18 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
+  if(p->leader == p){
+    // Memory goes when the last thread does.
+    stopthreads(p);
+
+    // Write back and unmap mapped files.
+    munmapall(p);
   }
 
+  // Close all open files, unless other threads still use them.
+  fdtclose(p->fdt);
+  p->fdt = 0;
+
   begin_op();
   iput(p->cwd);
   end_op();
@@ -370,8 +723,11 @@ exit(int status)
   // Give any children to init.
   reparent(p);
 
-  // Parent might be sleeping in wait().
+  // Parent might be sleeping in wait() or join(),
+  // and the leader in stopthreads().
   wakeup(p->parent);
+  if(p->leader != p)
+    wakeup(p->leader);
   
   acquire(&p->lock);
 
@@ -385,10 +741,11 @@ exit(int status)
   panic("zombie exit");
 }
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
-int
-wait(uint64 addr)
+// Wait for a child process, or if threads is set a
+// child thread, to exit and return its pid.
+// Return -1 if this process has no such children.
+static int
+reap(uint64 addr, int threads)
 {
   struct proc *pp;
   int havekids, pid;
@@ -399,8 +756,8 @@ wait(uint64 addr)
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
+    for(pp = procnext(0); pp; pp = procnext(pp)){
+      if(pp->parent == p && (pp->leader != pp) == threads){
         // make sure the child isn't still in exit() or swtch().
         acquire(&pp->lock);
 
@@ -434,6 +791,19 @@ wait(uint64 addr)
   }
 }
 
+int
+wait(uint64 addr)
+{
+  return reap(addr, 0);
+}
+
+// Wait for a thread made by clone() to exit.
+int
+join(uint64 addr)
+{
+  return reap(addr, 1);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -454,7 +824,17 @@ scheduler(void)
     // processes are waiting.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
+    // a proc added since this hart last looked has a kernel
+    // stack that this hart's TLB may still hold as unmapped.
+    int n = __atomic_load_n(&nproc, __ATOMIC_ACQUIRE);
+    if(c->nproc != n){
+      sfence_vma();
+      c->nproc = n;
+    }
+
+    int found = 0;
+    for(int i = 0; i < n; i++) {
+      p = procat(i);
       acquire(&p->lock);
       if(p->state == RUNNABLE) {
         // Switch to chosen process.  It is the process's job
@@ -462,14 +842,27 @@ scheduler(void)
         // before jumping back to us.
         p->state = RUNNING;
         c->proc = p;
+        timerslice(1);
         swtch(&c->context, &p->context);
 
         // Process is done running for now.
         // It should have changed its p->state before coming back.
         c->proc = 0;
+        found = 1;
       }
       release(&p->lock);
     }
+
+    if(found == 0){
+      // nothing to run; zero a page for kalloc_zeroed(),
+      // then look again.
+      if(kzero())
+        continue;
+      // still nothing to do; don't take timer interrupts
+      // just to find out there's still nothing to run.
+      intr_off();
+      timerslice(0);
+    }
   }
 }
 
@@ -573,7 +966,7 @@ wakeup(void *chan)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  for(p = procnext(0); p; p = procnext(p)) {
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
@@ -584,6 +977,19 @@ wakeup(void *chan)
   }
 }
 
+// Wake up p if it is sleeping on chan.
+// Cheaper than wakeup() when the caller knows
+// which process is waiting.
+// Must be called without p->lock.
+void
+wakeproc(struct proc *p, void *chan)
+{
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan)
+    p->state = RUNNABLE;
+  release(&p->lock);
+}
+
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
@@ -592,7 +998,7 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = procnext(0); p; p = procnext(p)){
     acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
@@ -675,7 +1081,7 @@ procdump(void)
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = procnext(0); p; p = procnext(p)){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
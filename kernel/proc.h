@@ -24,19 +24,28 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 slice;               // mtime at which the current slice expires (TICKLESS).
+  uint64 timer;               // Value last written to this hart's MTIMECMP (TICKLESS).
+  int nproc;                  // Size of the process table at the last TLB flush.
+  int tlbflush;               // Another hart's tlbshootdown() wants a TLB flush.
+  uint tlbacks;               // Count of TLB flushes for tlbshootdown().
 };
 
 extern struct cpu cpus[NCPU];
 
-// per-process data for the trap handling code in trampoline.S.
+// per-thread data for the trap handling code in trampoline.S.
 // sits in a page by itself just under the trampoline page in the
-// user page table. not specially mapped in the kernel page table.
+// user page table, or for a clone()d thread a few pages lower, at
+// THREADFRAME(p->tslot). not specially mapped in the kernel page table.
 // uservec in trampoline.S saves user registers in the trapframe,
 // then initializes registers from the trapframe's
 // kernel_sp, kernel_hartid, kernel_satp, and jumps to kernel_trap.
-// usertrapret() and userret in trampoline.S set up
-// the trapframe's kernel_*, restore user registers from the
-// trapframe, switch to the user page table, and enter user space.
+// allocproc() sets up the trapframe's kernel_*, and usertrapret()
+// keeps kernel_hartid current. userret in trampoline.S restores
+// user registers from the trapframe, switches to the user page
+// table, and enters user space. for system calls, uservec skips
+// saving the temporaries, and sysret restores only the registers
+// a function call must preserve, plus a0.
 // the trapframe includes callee-saved user registers like s0-s11 because the
 // return-to-user path via usertrapret() doesn't return through
 // the entire kernel call stack.
@@ -79,8 +88,27 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// a file or anonymous memory mapped into a process by mmap().
+struct vma {
+  int used;
+  uint64 addr;                 // page-aligned start
+  uint64 len;                  // bytes, a multiple of PGSIZE
+  int prot;                    // PROT_ bits from fcntl.h
+  int flags;                   // MAP_ bits from fcntl.h
+  struct file *f;              // 0 if MAP_ANONYMOUS
+  uint off;                    // file offset of addr
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// a process's open files, by descriptor. shared by the
+// threads of a process, like its page table.
+struct fdtable {
+  struct spinlock lock;       // protects ofile[] and ref
+  int ref;                    // processes and threads using it
+  struct file *ofile[NOFILE];
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -92,16 +120,46 @@ struct proc {
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  int nthread;                 // Live clone()d threads, if a leader
+  uint tslots;                 // THREADFRAME()s in use, if a leader
+
+  // tickslock must be held when using these:
+  uint wakeat;                 // Tick at which sys_sleep() is due
+  int sleepidx;                // Position in sleepq heap, or 0
+
+  // set when the process table grows.
+  int idx;                     // Index in the process table
+  struct sleeplock *mmlock;    // lockmm() of the threads p leads
+  struct proc *nextfree;       // On the free list, if UNUSED
+
+  // set when the thread is created.
+  struct proc *leader;         // Owner of the address space; p if not clone()d
+  int tslot;                   // Trapframe is at THREADFRAME(tslot)
+
+  // harts that may have stale TLB entries for the leader's
+  // ASID; see tlbstale(). updated atomically.
+  uint64 tlbstale;
+  uint64 mmgen;                // Bumped by tlbstale()
 
   // these are private to the process, so p->lock need not be held.
+  // threads share their leader's page table and mappings, and lockmm()
+  // serializes changes to them; every thread keeps a copy of sz.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  struct usyscall *usyscall;   // read-only page at USYSCALL
+  uint64 ucva;                 // Last user page copyin()/copyout() used,
+  uint64 ucpa;                 //   its physical address or 0,
+  uint64 ucgen;                //   and the leader's mmgen then
+  int ucwrite;                 // copyout() may use ucpa
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct fdtable *fdt;         // Open files, shared with p's threads
+  struct file *fheld[2];       // Files fdfile() holds for this system call
+  int nfheld;
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // Mapped files; only the leader's are used
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,180 @@
+//
+// slab allocator for small kernel objects, such as pipes.
+// a slab is a block of pages from kallocpages(), aligned
+// to its size, with a struct slab at the start and the
+// objects after it, so an object's slab is found by
+// rounding its address down.
+//
+// slaballoc() and slabfree() mostly just pop and push the
+// calling CPU's magazine; only when it runs empty or full
+// do they take the cache lock to move NMAG/2 objects from
+// or to the slabs.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "defs.h"
+
+struct obj {
+  struct obj *next;
+};
+
+struct slab {
+  struct slab *next;  // on the partial list
+  struct slab *prev;
+  struct obj *free;   // free objects of this slab
+  int inuse;          // objects allocated or in a magazine
+};
+
+void
+slabinit(struct slabcache *c, char *name, uint size)
+{
+  int order;
+
+  size = (size + 7) & ~7;
+  // at least a few objects per slab.
+  for(order = 0; order < MAXORDER; order++)
+    if((PGSIZE << order) - sizeof(struct slab) >= 4*size)
+      break;
+  if((PGSIZE << order) - sizeof(struct slab) < size)
+    panic("slabinit: too big");
+
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = size;
+  c->order = order;
+  c->partial = 0;
+  for(int i = 0; i < NCPU; i++)
+    c->mag[i].n = 0;
+}
+
+static void
+slabadd(struct slabcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+static void
+slabdel(struct slabcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Allocate and carve up a new slab, and put it on the
+// partial list. Caller must hold c->lock.
+static struct slab*
+slabgrow(struct slabcache *c)
+{
+  struct slab *s;
+  char *p, *end;
+
+  if((s = kallocpages(c->order)) == 0)
+    return 0;
+  s->free = 0;
+  s->inuse = 0;
+  end = (char*)s + (PGSIZE << c->order);
+  for(p = (char*)(s + 1); p + c->size <= end; p += c->size){
+    ((struct obj*)p)->next = s->free;
+    s->free = (struct obj*)p;
+  }
+  slabadd(c, s);
+  return s;
+}
+
+// Move up to NMAG/2 free objects from the slabs into
+// magazine m. Caller must hold c->lock.
+static void
+refill(struct slabcache *c, struct magazine *m)
+{
+  struct slab *s;
+  struct obj *o;
+
+  while(m->n < NMAG/2){
+    if((s = c->partial) == 0 && (s = slabgrow(c)) == 0)
+      break;
+    o = s->free;
+    s->free = o->next;
+    s->inuse++;
+    if(s->free == 0)
+      slabdel(c, s);
+    m->obj[m->n++] = o;
+  }
+}
+
+// Give the top NMAG/2 objects of magazine m back to their
+// slabs, freeing slabs that become empty.
+// Caller must hold c->lock.
+static void
+flush(struct slabcache *c, struct magazine *m)
+{
+  struct slab *s;
+  struct obj *o;
+
+  while(m->n > NMAG/2){
+    o = m->obj[--m->n];
+    s = (struct slab*)((uint64)o & ~((uint64)(PGSIZE << c->order) - 1));
+    if(s->free == 0)
+      slabadd(c, s);
+    o->next = s->free;
+    s->free = o;
+    if(--s->inuse == 0){
+      slabdel(c, s);
+      kfreepages(s, c->order);
+    }
+  }
+}
+
+// Allocate an object from cache c.
+// Returns 0 if out of memory.
+void*
+slaballoc(struct slabcache *c)
+{
+  struct magazine *m;
+  void *o = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    refill(c, m);
+    release(&c->lock);
+  }
+  if(m->n > 0)
+    o = m->obj[--m->n];
+  pop_off();
+  return o;
+}
+
+// Free an object that slaballoc(c) returned.
+void
+slabfree(struct slabcache *c, void *o)
+{
+  struct magazine *m;
+
+#ifndef NOJUNK
+  // Fill with junk to catch dangling refs.
+  memset(o, 1, c->size);
+#endif
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == NMAG){
+    acquire(&c->lock);
+    flush(c, m);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = o;
+  pop_off();
+}
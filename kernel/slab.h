@@ -0,0 +1,16 @@
+// A cache of equally sized kernel objects, carved out of
+// blocks of pages ("slabs") from kallocpages().
+struct slabcache {
+  struct spinlock lock;  // protects the slabs, not the magazines
+  char *name;
+  uint size;             // bytes per object, rounded up
+  int order;             // kallocpages() order of each slab
+  struct slab *partial;  // slabs with free objects
+
+  // each CPU's stack of free objects, used with interrupts
+  // off and no lock.
+  struct magazine {
+    int n;
+    void *obj[NMAG];
+  } mag[NCPU];
+};
@@ -9,24 +9,68 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+// every initialized sleep lock, for statssleeplock(),
+// kept like the spinlocks in spinlock.c.
+static struct sleeplock *sleeplocks[NLOCK];
+static int nslot;
+static int freeslots[NLOCK];
+static int nfreeslots;
+static struct rwspinlock lock_sleeplocks;
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->readers = 0;
+  lk->writers = 0;
   lk->pid = 0;
+  lk->n = 0;
+  lk->nts = 0;
+  lk->hold = 0;
+
+  acquirewrite(&lock_sleeplocks);
+  if(nfreeslots > 0)
+    lk->slot = freeslots[--nfreeslots];
+  else if(nslot < NLOCK)
+    lk->slot = nslot++;
+  else
+    lk->slot = -1;
+  if(lk->slot >= 0)
+    sleeplocks[lk->slot] = lk;
+  releasewrite(&lock_sleeplocks);
+}
+
+// Forget about a sleep lock whose memory is about to be freed.
+void
+freesleeplock(struct sleeplock *lk)
+{
+  acquirewrite(&lock_sleeplocks);
+  if(lk->slot >= 0){
+    sleeplocks[lk->slot] = 0;
+    freeslots[nfreeslots++] = lk->slot;
+    lk->slot = -1;
+  }
+  releasewrite(&lock_sleeplocks);
+  freelock(&lk->lk);
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
-  while (lk->locked) {
+  if(lk->locked || lk->readers)
+    lk->nts++;
+  lk->writers++;
+  while (lk->locked || lk->readers) {
     sleep(lk, &lk->lk);
   }
+  lk->writers--;
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->n++;
+  lk->start = r_time();
   release(&lk->lk);
 }
 
@@ -34,12 +78,42 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  lk->hold += r_time() - lk->start;
   lk->locked = 0;
   lk->pid = 0;
   wakeup(lk);
   release(&lk->lk);
 }
 
+// Acquire lk shared with other readers. Waits while a
+// process holds it exclusively or is waiting to, so that
+// readers can't starve acquiresleep().
+void
+acquiresleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->locked || lk->writers)
+    lk->nts++;
+  while (lk->locked || lk->writers) {
+    sleep(lk, &lk->lk);
+  }
+  lk->readers++;
+  lk->n++;
+  release(&lk->lk);
+}
+
+void
+releasesleepshared(struct sleeplock *lk)
+{
+  acquire(&lk->lk);
+  if(lk->readers < 1)
+    panic("releasesleepshared");
+  lk->readers--;
+  if(lk->readers == 0)
+    wakeup(lk);
+  release(&lk->lk);
+}
+
 int
 holdingsleep(struct sleeplock *lk)
 {
@@ -51,5 +125,44 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Is sleep lock i more contended than sleep lock j?
+static int
+morecontended(int i, int j)
+{
+  if(sleeplocks[i]->nts != sleeplocks[j]->nts)
+    return sleeplocks[i]->nts > sleeplocks[j]->nts;
+  return i < j;
+}
 
+// Describe the ntop sleep locks that made acquiresleep()
+// sleep most often, most contended first.
+// Returns the number of bytes written to buf.
+int
+statssleeplock(char *buf, int sz, int ntop)
+{
+  int i, t, top, last, n;
+  struct sleeplock *lk;
 
+  acquireread(&lock_sleeplocks);
+  n = snprintf(buf, sz, "--- top %d contended sleeplocks:\n", ntop);
+  last = -1;
+  for(t = 0; t < ntop; t++){
+    top = -1;
+    for(i = 0; i < nslot; i++){
+      if(sleeplocks[i] == 0 || sleeplocks[i]->n == 0)
+        continue;
+      if(last >= 0 && !morecontended(last, i))
+        continue;
+      if(top < 0 || morecontended(i, top))
+        top = i;
+    }
+    if(top < 0)
+      break;
+    lk = sleeplocks[top];
+    n += snprintf(buf+n, sz-n, "sleeplock: %s: #sleeps %l #acquire() %l #hold %l\n",
+                  lk->name, lk->nts, lk->n, lk->hold);
+    last = top;
+  }
+  releaseread(&lock_sleeplocks);
+  return n;
+}
@@ -1,10 +1,21 @@
 // Long-term locks for processes
+// Held either exclusively by one process (acquiresleep())
+// or shared by any number of readers (acquiresleepshared()).
 struct sleeplock {
-  uint locked;       // Is the lock held?
+  uint locked;       // Is the lock held exclusively?
+  int readers;       // Number of shared holders
+  int writers;       // Number of processes waiting in acquiresleep()
   struct spinlock lk; // spinlock protecting this sleep lock
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  // For statistics:
+  uint64 n;          // Number of times acquired.
+  uint64 nts;        // Number of times acquiresleep() had to sleep.
+  uint64 start;      // time when last acquired.
+  uint64 hold;       // Total time held, in timer cycles.
+  int slot;          // Index in the statistics registry, or -1.
 };
 
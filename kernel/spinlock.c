@@ -8,12 +8,54 @@
 #include "proc.h"
 #include "defs.h"
 
+// every initialized lock, for statslock(). locks[nslot..]
+// have never been used; freed slots are kept on freeslots.
+// once all NLOCK are in use, new locks go untracked.
+static struct spinlock *locks[NLOCK];
+static int nslot;
+static int freeslots[NLOCK];
+static int nfreeslots;
+static struct rwspinlock lock_locks;
+
+static void
+findslot(struct spinlock *lk)
+{
+  acquirewrite(&lock_locks);
+  if(nfreeslots > 0)
+    lk->slot = freeslots[--nfreeslots];
+  else if(nslot < NLOCK)
+    lk->slot = nslot++;
+  else
+    lk->slot = -1;
+  if(lk->slot >= 0)
+    locks[lk->slot] = lk;
+  releasewrite(&lock_locks);
+}
+
+// Forget about a lock whose memory is about to be freed.
+void
+freelock(struct spinlock *lk)
+{
+  acquirewrite(&lock_locks);
+  if(lk->slot >= 0){
+    locks[lk->slot] = 0;
+    freeslots[nfreeslots++] = lk->slot;
+    lk->slot = -1;
+  }
+  releasewrite(&lock_locks);
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->ticket = 0;
+  lk->serving = 0;
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
+  lk->hold = 0;
+  findslot(lk);
 }
 
 // Acquire the lock.
@@ -21,16 +63,34 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket, serving;
+  uint64 spins = 0;
+  int delay = 1;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+  // Take a ticket.
+  // On RISC-V, sync_fetch_and_add turns into an atomic add:
   //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  //   s1 = &lk->ticket
+  //   amoadd.w a4, a5, (s1)
+  ticket = __sync_fetch_and_add(&lk->ticket, 1);
+
+  // Wait for our turn. Back off exponentially between looks at
+  // lk->serving so that waiters don't keep stealing its cache line
+  // from the holder, but never for longer than it should take the
+  // CPUs ahead of us in line to get through.
+  while((serving = *(volatile uint*)&lk->serving) != ticket){
+    spins++;
+    if(delay < (ticket - serving) * BACKOFF)
+      delay *= 2;
+    else
+      delay = (ticket - serving) * BACKOFF;
+    for(int i = 0; i < delay; i++)
+      asm volatile("nop");
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -40,6 +100,10 @@ acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+  lk->n++;
+  if(spins)
+    lk->nts += spins;
+  lk->start = r_time();
 }
 
 // Release the lock.
@@ -49,6 +113,7 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  lk->hold += r_time() - lk->start;
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,14 +124,12 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // Hand the lock to the next ticket. Only the holder writes
+  // lk->serving, but use an atomic add rather than a C increment
+  // so that the waiters see a single store:
+  //   s1 = &lk->serving
+  //   amoadd.w zero, a5, (s1)
+  __sync_fetch_and_add(&lk->serving, 1);
 
   pop_off();
 }
@@ -77,10 +140,68 @@ int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lk->ticket != lk->serving && lk->cpu == mycpu());
   return r;
 }
 
+void
+initrwlock(struct rwspinlock *lk, char *name)
+{
+  lk->name = name;
+  lk->cnt = 0;
+  lk->writers = 0;
+}
+
+// Acquire the lock for reading, alongside any other readers.
+// Waits while a writer holds the lock or is waiting for it,
+// so that a stream of readers can't starve writers.
+void
+acquireread(struct rwspinlock *lk)
+{
+  int cnt;
+
+  push_off(); // disable interrupts to avoid deadlock.
+  for(;;){
+    cnt = *(volatile int*)&lk->cnt;
+    if(cnt >= 0 && *(volatile int*)&lk->writers == 0 &&
+       __sync_bool_compare_and_swap(&lk->cnt, cnt, cnt + 1))
+      break;
+  }
+
+  // the compare-and-swap is a full barrier; see acquire().
+  __sync_synchronize();
+}
+
+void
+releaseread(struct rwspinlock *lk)
+{
+  __sync_synchronize();
+  if(__sync_fetch_and_sub(&lk->cnt, 1) < 1)
+    panic("releaseread");
+  pop_off();
+}
+
+// Acquire the lock exclusively.
+void
+acquirewrite(struct rwspinlock *lk)
+{
+  push_off(); // disable interrupts to avoid deadlock.
+  __sync_fetch_and_add(&lk->writers, 1);
+  while(!__sync_bool_compare_and_swap(&lk->cnt, 0, -1))
+    ;
+  __sync_fetch_and_sub(&lk->writers, 1);
+  __sync_synchronize();
+}
+
+void
+releasewrite(struct rwspinlock *lk)
+{
+  __sync_synchronize();
+  if(!__sync_bool_compare_and_swap(&lk->cnt, -1, 0))
+    panic("releasewrite");
+  pop_off();
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -108,3 +229,50 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+static int
+snprint_lock(char *buf, int sz, struct spinlock *lk)
+{
+  return snprintf(buf, sz, "lock: %s: #spins %l #acquire() %l #hold %l\n",
+                  lk->name, lk->nts, lk->n, lk->hold);
+}
+
+// Is lock i more contended than lock j? Breaks ties by
+// slot so that each lock has a distinct rank.
+static int
+morecontended(int i, int j)
+{
+  if(locks[i]->nts != locks[j]->nts)
+    return locks[i]->nts > locks[j]->nts;
+  return i < j;
+}
+
+// Describe the ntop spinlocks with the most spinning in
+// acquire(), most contended first.
+// Returns the number of bytes written to buf.
+int
+statslock(char *buf, int sz, int ntop)
+{
+  int i, t, top, last, n;
+
+  acquireread(&lock_locks);
+  n = snprintf(buf, sz, "--- top %d contended spinlocks:\n", ntop);
+  last = -1;
+  for(t = 0; t < ntop; t++){
+    top = -1;
+    for(i = 0; i < nslot; i++){
+      if(locks[i] == 0 || locks[i]->n == 0)
+        continue;
+      if(last >= 0 && !morecontended(last, i))
+        continue;
+      if(top < 0 || morecontended(i, top))
+        top = i;
+    }
+    if(top < 0)
+      break;
+    n += snprint_lock(buf+n, sz-n, locks[top]);
+    last = top;
+  }
+  releaseread(&lock_locks);
+  return n;
+}
@@ -1,9 +1,29 @@
 // Mutual exclusion lock.
+// A ticket lock: acquire() takes the next ticket and waits until
+// serving reaches it, so CPUs get the lock in the order they asked.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint ticket;       // Next ticket to hand out.
+  uint serving;      // Ticket of the current (or next) holder.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For statistics:
+  uint64 n;          // Number of times acquired.
+  uint64 nts;        // Number of times acquire() spun waiting.
+  uint64 start;      // time when last acquired.
+  uint64 hold;       // Total time held, in timer cycles.
+  int slot;          // Index in the statistics registry, or -1.
+};
+
+// Reader-writer spin lock: any number of readers,
+// or a single writer.
+struct rwspinlock {
+  int cnt;           // Number of readers, or -1 if held by a writer.
+  int writers;       // Number of CPUs waiting in acquirewrite().
+
+  // For debugging:
+  char *name;        // Name of lock.
 };
 
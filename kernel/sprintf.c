@@ -0,0 +1,101 @@
+//
+// formatted output into a kernel buffer -- snprintf.
+//
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+static char digits[] = "0123456789abcdef";
+
+static void
+sputc(char *buf, int sz, int *off, char c)
+{
+  if(*off < sz)
+    buf[(*off)++] = c;
+}
+
+static void
+sprintint(char *buf, int sz, int *off, uint64 xx, int base, int sign)
+{
+  char tmp[24];
+  int i;
+  uint64 x;
+
+  if(sign && (sign = (long)xx < 0))
+    x = -xx;
+  else
+    x = xx;
+
+  i = 0;
+  do {
+    tmp[i++] = digits[x % base];
+  } while((x /= base) != 0);
+
+  if(sign)
+    tmp[i++] = '-';
+
+  while(--i >= 0)
+    sputc(buf, sz, off, tmp[i]);
+}
+
+// Print into buf, writing at most sz bytes and no
+// terminating nul. Understands %d, %l (uint64), %x, %s.
+// Returns the number of bytes written.
+int
+snprintf(char *buf, int sz, char *fmt, ...)
+{
+  va_list ap;
+  int i, c, off;
+  char *s;
+
+  if(fmt == 0)
+    panic("null fmt");
+
+  off = 0;
+  va_start(ap, fmt);
+  for(i = 0; (c = fmt[i] & 0xff) != 0 && off < sz; i++){
+    if(c != '%'){
+      sputc(buf, sz, &off, c);
+      continue;
+    }
+    c = fmt[++i] & 0xff;
+    if(c == 0)
+      break;
+    switch(c){
+    case 'd':
+      sprintint(buf, sz, &off, va_arg(ap, int), 10, 1);
+      break;
+    case 'l':
+      sprintint(buf, sz, &off, va_arg(ap, uint64), 10, 0);
+      break;
+    case 'x':
+      sprintint(buf, sz, &off, va_arg(ap, uint), 16, 0);
+      break;
+    case 's':
+      if((s = va_arg(ap, char*)) == 0)
+        s = "(null)";
+      for(; *s; s++)
+        sputc(buf, sz, &off, *s);
+      break;
+    case '%':
+      sputc(buf, sz, &off, '%');
+      break;
+    default:
+      // Print unknown % sequence to draw attention.
+      sputc(buf, sz, &off, '%');
+      sputc(buf, sz, &off, c);
+      break;
+    }
+  }
+  va_end(ap);
+
+  return off;
+}
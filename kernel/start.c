@@ -11,7 +11,7 @@ void timerinit();
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][7];
 
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
@@ -43,6 +43,13 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // allow supervisor mode to read the time CSR,
+  // used for lock hold times.
+  w_mcounteren(r_mcounteren() | 2);
+
+  // and user mode, for benchmarks like sysbench.
+  w_scounteren(r_scounteren() | 2);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -66,16 +73,24 @@ timerinit()
   int id = r_mhartid();
 
   // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
+  int interval = TICKINTERVAL;
   *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
-  // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[4] : desired interval (in cycles) between timer interrupts,
+  //              or 0 if the kernel reprograms MTIMECMP itself.
+  // scratch[5] : address of CLINT MSIP register.
+  // scratch[6] : set on a timer interrupt, for devintr().
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
+  scratch[5] = CLINT_MSIP(id);
+#ifdef TICKLESS
+  scratch[4] = 0;
+#else
   scratch[4] = interval;
+#endif
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -84,6 +99,7 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer interrupts, and software
+  // interrupts, by which other harts ask for a TLB flush.
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
@@ -0,0 +1,89 @@
+//
+// the statistics device: reading it returns a report
+// of the most contended spinlocks and sleeplocks.
+// writing a number to it sets how many of each to report.
+//
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define BUFSZ 4096
+
+static struct {
+  struct spinlock lock;
+  char buf[BUFSZ];
+  int sz;    // bytes of report in buf, or 0 if none yet.
+  int off;   // how much of buf has been read.
+  int ntop;  // how many locks of each kind to report.
+} stats;
+
+int
+statswrite(int user_src, uint64 src, int n)
+{
+  char s[16];
+  int i, ntop;
+
+  if(n >= sizeof(s))
+    return -1;
+  if(either_copyin(s, user_src, src, n) == -1)
+    return -1;
+
+  ntop = 0;
+  for(i = 0; i < n && '0' <= s[i] && s[i] <= '9'; i++)
+    ntop = ntop*10 + s[i] - '0';
+  if(i == 0 || ntop > NLOCK)
+    return -1;
+
+  acquire(&stats.lock);
+  stats.ntop = ntop;
+  release(&stats.lock);
+  return n;
+}
+
+// Copy out the report, generating it on the first read.
+// Returns 0 once it has all been read, and starts afresh
+// on the next read after that.
+int
+statsread(int user_dst, uint64 dst, int n)
+{
+  int m;
+
+  acquire(&stats.lock);
+
+  if(stats.sz == 0){
+    stats.sz = statslock(stats.buf, BUFSZ, stats.ntop);
+    stats.sz += statssleeplock(stats.buf+stats.sz, BUFSZ-stats.sz, stats.ntop);
+  }
+  m = stats.sz - stats.off;
+
+  if(m > 0){
+    if(m > n)
+      m = n;
+    if(either_copyout(user_dst, dst, stats.buf+stats.off, m) == -1)
+      m = -1;
+    else
+      stats.off += m;
+  } else {
+    m = 0;
+    stats.sz = 0;
+    stats.off = 0;
+  }
+  release(&stats.lock);
+  return m;
+}
+
+void
+statsinit(void)
+{
+  initlock(&stats.lock, "stats");
+  stats.ntop = 5;
+
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = statswrite;
+}
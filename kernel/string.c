@@ -1,13 +1,33 @@
 #include "types.h"
 
+// the byte c in every byte of a word.
+#define SPLAT(c) ((uint64)(uchar)(c) * 0x0101010101010101UL)
+
+// the string functions below work a 64-bit word at a time where
+// they can, since they are mostly used on whole pages and blocks.
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w = SPLAT(c);
+
+  if(n >= 16){
+    while(((uint64)cdst & 7) != 0){
+      *cdst++ = c;
+      n--;
+    }
+    for(; n >= 32; n -= 32, cdst += 32){
+      ((uint64*)cdst)[0] = w;
+      ((uint64*)cdst)[1] = w;
+      ((uint64*)cdst)[2] = w;
+      ((uint64*)cdst)[3] = w;
+    }
+    for(; n >= 8; n -= 8, cdst += 8)
+      *(uint64*)cdst = w;
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +38,17 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & 7) == 0){
+    while(n > 0 && ((uint64)s1 & 7) != 0){
+      if(*s1 != *s2)
+        return *s1 - *s2;
+      s1++, s2++, n--;
+    }
+    // skip equal words; the bytes of the first unequal
+    // one are compared below.
+    while(n >= 8 && *(uint64*)s1 == *(uint64*)s2)
+      s1 += 8, s2 += 8, n -= 8;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -27,6 +58,35 @@ memcmp(const void *v1, const void *v2, uint n)
   return 0;
 }
 
+// Copy n bytes from src to dst, eight at a time when src and
+// dst are equally aligned. Copies forwards, so it is safe for
+// overlapping buffers if dst is below src.
+// GCC also calls it to copy structures.
+void*
+memcpy(void *dst, const void *src, uint n)
+{
+  const char *s = src;
+  char *d = dst;
+
+  if((((uint64)s ^ (uint64)d) & 7) == 0){
+    while(n > 0 && ((uint64)d & 7) != 0){
+      *d++ = *s++;
+      n--;
+    }
+    for(; n >= 32; n -= 32, d += 32, s += 32){
+      ((uint64*)d)[0] = ((const uint64*)s)[0];
+      ((uint64*)d)[1] = ((const uint64*)s)[1];
+      ((uint64*)d)[2] = ((const uint64*)s)[2];
+      ((uint64*)d)[3] = ((const uint64*)s)[3];
+    }
+    for(; n >= 8; n -= 8, d += 8, s += 8)
+      *(uint64*)d = *(const uint64*)s;
+  }
+  while(n-- > 0)
+    *d++ = *s++;
+  return dst;
+}
+
 void*
 memmove(void *dst, const void *src, uint n)
 {
@@ -41,22 +101,25 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if((((uint64)s ^ (uint64)d) & 7) == 0){
+      while(n > 0 && ((uint64)d & 7) != 0){
+        *--d = *--s;
+        n--;
+      }
+      for(; n >= 8; n -= 8){
+        d -= 8;
+        s -= 8;
+        *(uint64*)d = *(const uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
   } else
-    while(n-- > 0)
-      *d++ = *s++;
+    memcpy(d, s, n);
 
   return dst;
 }
 
-// memcpy exists to placate GCC.  Use memmove.
-void*
-memcpy(void *dst, const void *src, uint n)
-{
-  return memmove(dst, src, n);
-}
-
 int
 strncmp(const char *p, const char *q, uint n)
 {
@@ -20,3 +20,14 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_uring  22
+#define SYS_readv  23
+#define SYS_writev 24
+#define SYS_pread  25
+#define SYS_pwrite 26
+#define SYS_mmap   27
+#define SYS_munmap 28
+#define SYS_clone  29
+#define SYS_join   30
+#define SYS_futexwait 31
+#define SYS_futexwake 32
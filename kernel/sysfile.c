@@ -15,6 +15,43 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uring.h"
+#include "uio.h"
+
+// The open file for descriptor fd, or 0.
+// If other threads share the descriptor table, one of them
+// could close fd while this system call uses the file, so
+// hold a reference to it until fdrelease().
+static struct file*
+fdfile(int fd)
+{
+  struct proc *p = myproc();
+  struct fdtable *t = p->fdt;
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&t->lock);
+  f = t->ofile[fd];
+  if(f && t->ref > 1){
+    if(p->nfheld == NELEM(p->fheld))
+      panic("fdfile");
+    p->fheld[p->nfheld++] = filedup(f);
+  }
+  release(&t->lock);
+  return f;
+}
+
+// Drop the references fdfile() held for the current
+// system call. Called with no locks held.
+void
+fdrelease(void)
+{
+  struct proc *p = myproc();
+
+  while(p->nfheld > 0)
+    fileclose(p->fheld[--p->nfheld]);
+}
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -25,7 +62,7 @@ argfd(int n, int *pfd, struct file **pf)
   struct file *f;
 
   argint(n, &fd);
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if((f = fdfile(fd)) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -40,17 +77,38 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct fdtable *t = myproc()->fdt;
 
+  acquire(&t->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(t->ofile[fd] == 0){
+      t->ofile[fd] = f;
+      release(&t->lock);
       return fd;
     }
   }
+  release(&t->lock);
   return -1;
 }
 
+// Take f out of descriptor fd, unless another thread has
+// already closed fd. Returns 1 if it did, and the caller
+// now owns the table's reference to f.
+static int
+fdforget(int fd, struct file *f)
+{
+  struct fdtable *t = myproc()->fdt;
+  int r = 0;
+
+  acquire(&t->lock);
+  if(t->ofile[fd] == f){
+    t->ofile[fd] = 0;
+    r = 1;
+  }
+  release(&t->lock);
+  return r;
+}
+
 uint64
 sys_dup(void)
 {
@@ -59,9 +117,13 @@ sys_dup(void)
 
   if(argfd(0, 0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
-    return -1;
+  // take the new descriptor's reference first, in case
+  // another thread closes it at once.
   filedup(f);
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
   return fd;
 }
 
@@ -94,19 +156,113 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
-uint64
-sys_close(void)
+static int
+fdclose(int fd)
 {
-  int fd;
+  struct fdtable *t = myproc()->fdt;
   struct file *f;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  acquire(&t->lock);
+  f = t->ofile[fd];
+  t->ofile[fd] = 0;
+  release(&t->lock);
+  if(f == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
 
+// Fetch the iovec array for readv() or writev(). The
+// lengths must add up to at most INT_MAX, the most that
+// either can return.
+static int
+argiov(struct iovec *iov, int *pn)
+{
+  uint64 uiov, tot = 0;
+  int i, n;
+
+  argaddr(1, &uiov);
+  argint(2, &n);
+  if(n < 0 || n > IOV_MAX)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, uiov, n*sizeof(struct iovec)) < 0)
+    return -1;
+  for(i = 0; i < n; i++){
+    if(iov[i].iov_len < 0)
+      return -1;
+    tot += iov[i].iov_len;
+  }
+  if(tot > INT_MAX)
+    return -1;
+  *pn = n;
+  return 0;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &n) < 0)
+    return -1;
+  return filereadv(f, iov, n);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int n;
+
+  if(argfd(0, 0, &f) < 0 || argiov(iov, &n) < 0)
+    return -1;
+  return filewritev(f, iov, n);
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  uint64 p;
+
+  argaddr(1, &p);
+  argint(2, &n);
+  argint(3, &off);
+  if(argfd(0, 0, &f) < 0 || n < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+uint64
+sys_close(void)
+{
+  int fd;
+
+  argint(0, &fd);
+  return fdclose(fd);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -301,18 +457,13 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path and return a new descriptor for it.
+static int
+fdopen(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -341,14 +492,13 @@ sys_open(void)
     return -1;
   }
 
-  if((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0){
-    if(f)
-      fileclose(f);
+  if((f = filealloc()) == 0){
     iunlockput(ip);
     end_op();
     return -1;
   }
 
+  // fill in f before another thread can reach it through fd.
   if(ip->type == T_DEVICE){
     f->type = FD_DEVICE;
     f->major = ip->major;
@@ -360,6 +510,14 @@ sys_open(void)
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
+  if((fd = fdalloc(f)) < 0){
+    f->type = FD_NONE;  // ip is put below, in this transaction
+    fileclose(f);
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
   }
@@ -370,6 +528,18 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return fdopen(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -418,13 +588,14 @@ sys_chdir(void)
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
   if(ip->type != T_DIR){
-    iunlockput(ip);
+    iunlockshared(ip);
+    iput(ip);
     end_op();
     return -1;
   }
-  iunlock(ip);
+  iunlockshared(ip);
   iput(p->cwd);
   end_op();
   p->cwd = ip;
@@ -487,19 +658,117 @@ sys_pipe(void)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
-    if(fd0 >= 0)
-      p->ofile[fd0] = 0;
-    fileclose(rf);
+    if(fd0 < 0 || fdforget(fd0, rf))
+      fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
-    fileclose(rf);
-    fileclose(wf);
+    if(fdforget(fd0, rf))
+      fileclose(rf);
+    if(fdforget(fd1, wf))
+      fileclose(wf);
     return -1;
   }
   return 0;
 }
+
+// Carry out one submission queue entry.
+static int
+ringop(struct sqe *e)
+{
+  char path[MAXPATH];
+  struct file *f;
+
+  switch(e->op){
+  case RING_NOP:
+    return 0;
+  case RING_READ:
+    if((f = fdfile(e->fd)) == 0)
+      return -1;
+    return fileread(f, e->addr, e->n);
+  case RING_WRITE:
+    if((f = fdfile(e->fd)) == 0)
+      return -1;
+    return filewrite(f, e->addr, e->n);
+  case RING_OPEN:
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return -1;
+    return fdopen(path, e->n);
+  case RING_CLOSE:
+    return fdclose(e->fd);
+  }
+  return -1;
+}
+
+// Run the submissions queued in the user's struct uring,
+// in order, posting a completion for each. Stops early
+// if the completion ring fills up.
+// Returns the number of entries consumed.
+uint64
+sys_uring(void)
+{
+  uint64 addr;
+  struct uring *u;  // user address; not dereferenced
+  uint idx[4];      // sqhead, sqtail, cqhead, cqtail
+  struct sqe e;
+  struct cqe c;
+  pagetable_t pagetable = myproc()->pagetable;
+  int n;
+
+  argaddr(0, &addr);
+  u = (struct uring *)addr;
+  if(copyin(pagetable, (char*)idx, addr, sizeof(idx)) < 0)
+    return -1;
+
+  for(n = 0; idx[0] != idx[1] && idx[3] - idx[2] < NRING; n++){
+    if(copyin(pagetable, (char*)&e, (uint64)&u->sq[idx[0] % NRING], sizeof(e)) < 0)
+      break;
+    c.data = e.data;
+    c.res = ringop(&e);
+    fdrelease();
+    c.pad = 0;
+    if(copyout(pagetable, (uint64)&u->cq[idx[3] % NRING], (char*)&c, sizeof(c)) < 0)
+      break;
+    idx[0]++;
+    idx[3]++;
+  }
+  if(copyout(pagetable, (uint64)&u->sqhead, (char*)&idx[0], sizeof(uint)) < 0 ||
+     copyout(pagetable, (uint64)&u->cqtail, (char*)&idx[3], sizeof(uint)) < 0)
+    return -1;
+  return n;
+}
+
+// mmap(addr, len, prot, flags, fd, off).
+// addr is only a hint, and is ignored.
+// fd is ignored if flags has MAP_ANONYMOUS.
+uint64
+sys_mmap(void)
+{
+  struct file *f = 0;
+  int len, prot, flags, off;
+
+  argint(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(5, &off);
+  if(len <= 0 || off < 0)
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  return mmap(f, len, prot, flags, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  if(len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
@@ -32,9 +32,56 @@ sys_wait(void)
 {
   uint64 p;
   argaddr(0, &p);
+  // reap() copies out the status with locks held.
+  if(p != 0)
+    mmapprefault(p, sizeof(int), 1);
   return wait(p);
 }
 
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  uint64 p;
+  argaddr(0, &p);
+  // reap() copies out the status with locks held.
+  if(p != 0)
+    mmapprefault(p, sizeof(int), 1);
+  return join(p);
+}
+
+uint64
+sys_futexwait(void)
+{
+  uint64 addr;
+  int val;
+
+  argaddr(0, &addr);
+  argint(1, &val);
+  return futexwait(addr, val);
+}
+
+uint64
+sys_futexwake(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return futexwake(addr, n);
+}
+
 uint64
 sys_sbrk(void)
 {
@@ -58,13 +105,14 @@ sys_sleep(void)
   if(n < 0)
     n = 0;
   acquire(&tickslock);
+  tickupdate();
   ticks0 = ticks;
   while(ticks - ticks0 < n){
     if(killed(myproc())){
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    ticksleep(ticks0 + n);
   }
   release(&tickslock);
   return 0;
@@ -87,6 +135,7 @@ sys_uptime(void)
   uint xticks;
 
   acquire(&tickslock);
+  tickupdate();
   xticks = ticks;
   release(&tickslock);
   return xticks;
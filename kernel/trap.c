@@ -5,21 +5,49 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "syscall.h"
+#include "fcntl.h"
 
 struct spinlock tickslock;
 uint ticks;
+struct ushared *ushared;
 
-extern char trampoline[], uservec[], userret[];
+extern char trampoline[], uservec[], userret[], sysret[];
+
+static void trapret(char*);
+
+// The access, for mmapfault(), that page fault scause was for:
+// an instruction fetch (12), a load (13), or a store (15).
+static int
+faultprot(uint64 scause)
+{
+  if(scause == 12)
+    return PROT_EXEC;
+  if(scause == 15)
+    return PROT_WRITE;
+  return PROT_READ;
+}
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
 extern int devintr();
 
+// in start.c; timervec in kernelvec.S sets timer_scratch[hart][6]
+// on a timer interrupt.
+extern uint64 timer_scratch[NCPU][7];
+
 void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+
+  if((ushared = (struct ushared *)kalloc()) == 0)
+    panic("trapinit");
+  memset(ushared, 0, PGSIZE);
+#ifdef TICKLESS
+  ushared->interval = TICKINTERVAL;
+#endif
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -37,6 +65,7 @@ void
 usertrap(void)
 {
   int which_dev = 0;
+  int fast = 0;
 
   if((r_sstatus() & SSTATUS_SPP) != 0)
     panic("usertrap: not from user mode");
@@ -60,6 +89,9 @@ usertrap(void)
     // but we want to return to the next instruction.
     p->trapframe->epc += 4;
 
+    // exec() sets up registers besides a0.
+    fast = p->trapframe->a7 != SYS_exec;
+
     // an interrupt will change sepc, scause, and sstatus,
     // so enable only now that we're done with those registers.
     intr_on();
@@ -67,6 +99,9 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            mmapfault(p->pagetable, r_stval(), faultprot(r_scause())) == 0){
+    // page of a mapping brought in
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -80,7 +115,7 @@ usertrap(void)
   if(which_dev == 2)
     yield();
 
-  usertrapret();
+  trapret(fast ? sysret : userret);
 }
 
 //
@@ -88,6 +123,13 @@ usertrap(void)
 //
 void
 usertrapret(void)
+{
+  trapret(userret);
+}
+
+// ret is userret or sysret in trampoline.S.
+static void
+trapret(char *ret)
 {
   struct proc *p = myproc();
 
@@ -100,11 +142,8 @@ usertrapret(void)
   uint64 trampoline_uservec = TRAMPOLINE + (uservec - trampoline);
   w_stvec(trampoline_uservec);
 
-  // set up trapframe values that uservec will need when
-  // the process next traps into the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
-  p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
-  p->trapframe->kernel_trap = (uint64)usertrap;
+  // allocproc() set the rest of the kernel_* fields,
+  // but the process may have moved to another hart.
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
 
   // set up the registers that trampoline.S's sret will use
@@ -119,14 +158,22 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to, and
+  // flush this hart's TLB entries for the page table's ASID
+  // if it has changed since this hart last used it.
+  uint64 asid = procasid(p);
+  uint64 satp = MAKE_SATP(p->pagetable) | SATP_ASID(asid);
+  uint64 hart = 1L << cpuid();
+  if(asid && (p->leader->tlbstale & hart)){
+    __atomic_fetch_and(&p->leader->tlbstale, ~hart, __ATOMIC_SEQ_CST);
+    sfence_vma_asid(asid);
+  }
 
-  // jump to userret in trampoline.S at the top of memory, which 
-  // switches to the user page table, restores user registers,
-  // and switches to user mode with sret.
-  uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64))trampoline_userret)(satp);
+  // jump to userret or sysret in trampoline.S at the top of memory,
+  // which switches to the user page table, restores user registers
+  // from this thread's trapframe, and switches to user mode with sret.
+  uint64 trampoline_ret = TRAMPOLINE + (ret - trampoline);
+  ((void (*)(uint64, uint64))trampoline_ret)(satp, THREADFRAME(p->tslot));
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -160,15 +207,224 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
+#ifdef TICKLESS
+// In tickless mode no hart takes a periodic interrupt.
+// Instead each hart programs its own MTIMECMP for the sooner of
+// the expiry of its running process's time slice and nextwake,
+// the earliest deadline of any process in sys_sleep(). Idle
+// harts with nothing to wake take no timer interrupts at all,
+// and ticks is computed from mtime when someone asks for it.
+
+// CLINT time at which the first sleeper in sleepq is due,
+// or -1 if none. Written with tickslock held.
+static volatile uint64 nextwake = -1;
+
+static inline uint64
+mtime(void)
+{
+  return *(volatile uint64*)CLINT_MTIME;
+}
+
+// Program this hart's timer. Interrupts must be off.
+static void
+timerset(struct cpu *c)
+{
+  uint64 when = c->slice < nextwake ? c->slice : nextwake;
+
+  if(when != c->timer){
+    c->timer = when;
+    *(volatile uint64*)CLINT_MTIMECMP(cpuid()) = when;
+  }
+}
+#endif
+
+// Processes in sys_sleep(), kept in a binary min-heap
+// ordered by p->wakeat, so that each one is woken exactly
+// once when its deadline arrives instead of on every tick.
+// sleepq.proc[1] is the earliest; p->sleepidx is p's
+// position, or 0 if p isn't in the heap.
+// Protected by tickslock.
+struct {
+  struct proc *proc[MAXPROC+1];
+  int n;
+} sleepq;
+
+// Is a's deadline before b's? Tolerates ticks wrapping.
+static int
+sleepbefore(struct proc *a, struct proc *b)
+{
+  return (int)(a->wakeat - b->wakeat) < 0;
+}
+
+static void
+sleepput(int i, struct proc *p)
+{
+  sleepq.proc[i] = p;
+  p->sleepidx = i;
+}
+
+static void
+sleepup(int i)
+{
+  struct proc *p = sleepq.proc[i];
+
+  while(i > 1 && sleepbefore(p, sleepq.proc[i/2])){
+    sleepput(i, sleepq.proc[i/2]);
+    i /= 2;
+  }
+  sleepput(i, p);
+}
+
+static void
+sleepdown(int i)
+{
+  struct proc *p = sleepq.proc[i];
+  int c;
+
+  while((c = 2*i) <= sleepq.n){
+    if(c < sleepq.n && sleepbefore(sleepq.proc[c+1], sleepq.proc[c]))
+      c++;
+    if(!sleepbefore(sleepq.proc[c], p))
+      break;
+    sleepput(i, sleepq.proc[c]);
+    i = c;
+  }
+  sleepput(i, p);
+}
+
+// Remove p from sleepq.
+static void
+sleepdel(struct proc *p)
+{
+  int i = p->sleepidx;
+  struct proc *last = sleepq.proc[sleepq.n--];
+
+  p->sleepidx = 0;
+  if(last != p){
+    sleepput(i, last);
+    sleepup(i);
+    sleepdown(last->sleepidx);
+  }
+}
+
+// The heap changed; make sure some hart will take a timer
+// interrupt by the earliest deadline, and none for a
+// deadline that is gone.
+static void
+sleeprearm(void)
+{
+#ifdef TICKLESS
+  if(sleepq.n > 0)
+    nextwake = (uint64)sleepq.proc[1]->wakeat * TICKINTERVAL;
+  else
+    nextwake = -1;
+  timerset(mycpu());
+#endif
+}
+
+// Wake every process in sleepq whose deadline has passed,
+// and rearm for the next one, so that a stale nextwake
+// never outlives the sleeper it was for.
+// Caller must hold tickslock, with ticks up to date.
+static void
+sleepexpire(void)
+{
+  struct proc *p;
+
+  while(sleepq.n > 0 && (int)(ticks - sleepq.proc[1]->wakeat) >= 0){
+    p = sleepq.proc[1];
+    sleepdel(p);
+    wakeproc(p, &p->wakeat);
+  }
+  sleeprearm();
+}
+
+// Sleep until ticks reaches t or something else, such as
+// kill(), wakes the process. Caller must hold tickslock.
+void
+ticksleep(uint t)
+{
+  struct proc *p = myproc();
+
+  p->wakeat = t;
+  sleepput(++sleepq.n, p);
+  sleepup(sleepq.n);
+  if(sleepq.proc[1] == p)
+    sleeprearm();
+
+  sleep(&p->wakeat, &tickslock);
+
+  if(p->sleepidx != 0){
+    // woken early, e.g. by kill().
+    sleepdel(p);
+    sleeprearm();
+  }
+}
+
 void
 clockintr()
 {
   acquire(&tickslock);
   ticks++;
-  wakeup(&ticks);
+  ushared->ticks = ticks;
+  sleepexpire();
   release(&tickslock);
 }
 
+#ifdef TICKLESS
+// Handle a timer interrupt forwarded by timervec,
+// which has already disarmed MTIMECMP.
+// Returns 2 if the current time slice has expired.
+static int
+timerintr(void)
+{
+  struct cpu *c = mycpu();
+  uint64 now = mtime();
+  int expired = 0;
+
+  c->timer = -1;
+
+  if(now >= nextwake){
+    acquire(&tickslock);
+    tickupdate();
+    sleepexpire();
+    release(&tickslock);
+  }
+
+  if(now >= c->slice){
+    // start another slice in case the caller can't yield.
+    c->slice = now + TICKINTERVAL;
+    expired = 1;
+  }
+  timerset(c);
+
+  return expired ? 2 : 1;
+}
+#endif
+
+// Bring ticks up to date. Caller must hold tickslock.
+void
+tickupdate(void)
+{
+#ifdef TICKLESS
+  ticks = mtime() / TICKINTERVAL;
+#endif
+}
+
+// Start a fresh time slice on this hart if busy,
+// or stop slicing because the hart is idle.
+// Called by scheduler() with interrupts off.
+void
+timerslice(int busy)
+{
+#ifdef TICKLESS
+  struct cpu *c = mycpu();
+
+  c->slice = busy ? mtime() + TICKINTERVAL : -1;
+  timerset(c);
+#endif
+}
+
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -203,15 +459,26 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // or from another hart's tlbshootdown(), forwarded by
+    // timervec in kernelvec.S.
+
+    // acknowledge the software interrupt by clearing
+    // the SSIP bit in sip. first, since timerintr() may
+    // arm a deadline that has already passed.
+    w_sip(r_sip() & ~2);
+
+    tlbintr();
+
+#ifdef TICKLESS
+    return timerintr();
+#endif
+
+    if(__atomic_exchange_n(&timer_scratch[cpuid()][6], 0, __ATOMIC_SEQ_CST) == 0)
+      return 1;
 
     if(cpuid() == 0){
       clockintr();
     }
-    
-    // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
-    w_sip(r_sip() & ~2);
 
     return 2;
   } else {
@@ -0,0 +1,8 @@
+// buffer descriptors for readv() and writev().
+
+#define IOV_MAX 16  // max buffers per call
+
+struct iovec {
+  void *iov_base;
+  int iov_len;
+};
@@ -0,0 +1,38 @@
+// Submission/completion ring shared by a process and the kernel.
+// The process fills sq[sqtail % NRING] and advances sqtail;
+// uring() consumes entries from sqhead and posts a result for
+// each at cq[cqtail % NRING]. The process reaps completions from
+// cqhead without a system call. Indices only ever increase.
+
+#define NRING 32   // entries in each ring; a power of two
+
+// operations
+#define RING_NOP   0
+#define RING_READ  1   // res = read(fd, addr, n)
+#define RING_WRITE 2   // res = write(fd, addr, n)
+#define RING_OPEN  3   // res = open((char*)addr, n)
+#define RING_CLOSE 4   // res = close(fd)
+
+struct sqe {
+  int op;
+  int fd;
+  uint64 addr;
+  int n;
+  int pad;
+  uint64 data;   // copied to the completion
+};
+
+struct cqe {
+  uint64 data;
+  int res;
+  int pad;
+};
+
+struct uring {
+  uint sqhead;   // advanced by the kernel
+  uint sqtail;   // advanced by the process
+  uint cqhead;   // advanced by the process
+  uint cqtail;   // advanced by the kernel
+  struct sqe sq[NRING];
+  struct cqe cq[NRING];
+};
@@ -3,8 +3,11 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
+#include "fcntl.h"
 
 /*
  * the kernel's page table.
@@ -15,6 +18,12 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// set if satp's ASID field can give every process its own
+// address-space ID; see procasid().
+int useasid;
+
+static pte_t *walklevel(pagetable_t, uint64, int, int, uint64*);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -30,6 +39,9 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, so the kernel can read mtime and program mtimecmp.
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -37,15 +49,17 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
+  // mappages() uses megapages for all but the first
+  // partial megapage.
   kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
-  proc_mapstacks(kpgtbl);
-  
+  // proc.c maps a kernel stack for each process as
+  // the process table grows.
+
   return kpgtbl;
 }
 
@@ -64,6 +78,11 @@ kvminithart()
   // wait for any previous writes to the page table memory to finish.
   sfence_vma();
 
+  // the ASID field keeps only as many bits as the hardware
+  // implements.
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID(0xFFFF));
+  useasid = SATP2ASID(r_satp()) >= MAXPROC;
+
   w_satp(MAKE_SATP(kernel_pagetable));
 
   // flush stale entries from the TLB.
@@ -82,46 +101,62 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+// A level-1 PTE may instead be a leaf that maps a 2-megabyte
+// megapage, valid or not (see uvminval()); walk() then returns
+// that PTE.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
+  return walklevel(pagetable, va, alloc, 0, 0);
+}
+
+// Like walk(), but stop at the PTE of level stop, and set
+// *size, if size isn't 0, to the bytes the PTE maps.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int stop, uint64 *size)
+{
+  int level;
+
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(level = 2; level > stop; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
+    if(*pte & (PTE_R|PTE_W|PTE_X))
+      break;  // a leaf, for a megapage.
     if(*pte & PTE_V) {
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  if(size)
+    *size = 1L << PXSHIFT(level);
+  return &pagetable[PX(level, va)];
 }
 
-// Look up a virtual address, return the physical address,
-// or 0 if not mapped.
+// Look up a virtual address, return the physical address
+// of the page holding it, or 0 if not mapped.
 // Can only be used to look up user pages.
 uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  uint64 pa;
+  uint64 pa, size;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, 0, 0, &size);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = PTE2PA(*pte) + PGROUNDDOWN(va & (size - 1));
   return pa;
 }
 
@@ -136,7 +171,8 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
-// physical addresses starting at pa.
+// physical addresses starting at pa, using megapages for any
+// whole megapages at which va and pa are both aligned.
 // va and size MUST be page-aligned.
 // Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
@@ -158,6 +194,19 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = va;
   last = va + size - PGSIZE;
   for(;;){
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       last - a >= SUPERPGSIZE - PGSIZE){
+      if((pte = walklevel(pagetable, a, 1, 1, 0)) == 0)
+        return -1;
+      if(*pte & PTE_V)
+        panic("mappages: remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+      if(last - a == SUPERPGSIZE - PGSIZE)
+        break;
+      a += SUPERPGSIZE;
+      pa += SUPERPGSIZE;
+      continue;
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -171,28 +220,62 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Replace the megapage PTE *pte, which maps va's megapage,
+// with the page-table page pt of PTEs for its pages. If pt
+// is 0, forget the page at va instead, and use its memory,
+// being unmapped, as the page-table page, so that this can't
+// run out of memory.
+static void
+splitmegapage(pte_t *pte, uint64 va, pagetable_t pt)
+{
+  uint64 pa = PTE2PA(*pte);
+  int perm = PTE_FLAGS(*pte);
+  int i, forget = pt == 0;
+
+  ksplit((void*)pa);
+  if(forget)
+    pt = (pagetable_t)(pa + (va - SUPERPGROUNDDOWN(va)));
+  for(i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | perm;
+  if(forget)
+    pt[PX(0, va)] = 0;
+  *pte = PA2PTE(pt) | PTE_V;
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. The mappings must exist, though uvminval()
+// may have invalidated them.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  uint64 a, size, end = va + npages*PGSIZE;
   pte_t *pte;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
+  for(a = va; a < end; a += size){
+    if((pte = walklevel(pagetable, a, 0, 0, &size)) == 0)
       panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
+    if(*pte == 0)
       panic("uvmunmap: not mapped");
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(size == SUPERPGSIZE && (a % SUPERPGSIZE != 0 || end - a < SUPERPGSIZE)){
+      // unmapping part of a megapage.
+      if(!do_free)
+        panic("uvmunmap: part of megapage");
+      splitmegapage(pte, a, 0);
+      size = PGSIZE;
+      continue;
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      if(size == SUPERPGSIZE)
+        superfree((void*)pa);
+      else
+        kfree((void*)pa);
     }
     *pte = 0;
   }
@@ -204,10 +287,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -221,31 +303,47 @@ uvmfirst(pagetable_t pagetable, uchar *src, uint sz)
 
   if(sz >= PGSIZE)
     panic("uvmfirst: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W|PTE_R|PTE_X|PTE_U);
   memmove(mem, src, sz);
 }
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Whole megapages in the new range get megapage frames, if
+// there are any free.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 {
   char *mem;
-  uint64 a;
+  uint64 a, size;
+  pte_t *pte;
 
   if(newsz < oldsz)
     return oldsz;
 
   oldsz = PGROUNDUP(oldsz);
-  for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+  for(a = oldsz; a < newsz; a += size){
+    size = SUPERPGSIZE;
+    // but not in place of a page-table page left by uvmunmap(),
+    // through which other harts' TLBs may still walk.
+    if(a % SUPERPGSIZE == 0 && newsz - a >= SUPERPGSIZE &&
+       ((pte = walklevel(pagetable, a, 0, 1, 0)) == 0 || (*pte & PTE_V) == 0) &&
+       (mem = superalloc()) != 0){
+      memset(mem, 0, SUPERPGSIZE);
+      if(mappages(pagetable, a, SUPERPGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
+        superfree(mem);
+        uvmdealloc(pagetable, a, oldsz);
+        return 0;
+      }
+      continue;
+    }
+    size = PGSIZE;
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -273,6 +371,33 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
+// Invalidate the PTEs of the pages that uvmdealloc() would
+// free, leaving their physical addresses for it to find once
+// tlbshootdown() has made sure no other hart can still use
+// them. Splits a megapage that newsz falls in, without unmapping
+// anything yet. Returns 0, or -1 if out of memory.
+int
+uvminval(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
+{
+  uint64 a, size;
+  pagetable_t pt;
+  pte_t *pte;
+
+  for(a = PGROUNDUP(newsz); a < PGROUNDUP(oldsz); a += size){
+    if((pte = walklevel(pagetable, a, 0, 0, &size)) == 0 || (*pte & PTE_V) == 0)
+      panic("uvminval");
+    if(size == SUPERPGSIZE && a % SUPERPGSIZE != 0){
+      if((pt = kalloc()) == 0)
+        return -1;
+      splitmegapage(pte, a, pt);
+      size = 0;
+      continue;
+    }
+    __atomic_fetch_and(pte, ~PTE_V, __ATOMIC_SEQ_CST);
+  }
+  return 0;
+}
+
 // Recursively free page-table pages.
 // All leaf mappings must already have been removed.
 void
@@ -313,17 +438,30 @@ int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
   pte_t *pte;
-  uint64 pa, i;
+  uint64 pa, i, size;
   uint flags;
   char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
+    if((pte = walklevel(old, i, 0, 0, &size)) == 0)
       panic("uvmcopy: pte should exist");
     if((*pte & PTE_V) == 0)
       panic("uvmcopy: page not present");
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
+    if(size == SUPERPGSIZE && i % SUPERPGSIZE == 0 &&
+       (mem = superalloc()) != 0){
+      memmove(mem, (char*)pa, SUPERPGSIZE);
+      if(mappages(new, i, SUPERPGSIZE, (uint64)mem, flags) != 0){
+        superfree(mem);
+        goto err;
+      }
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
+    // a megapage is copied a page at a time
+    // if there's no frame to copy it to.
+    pa += i & (size - 1);
     if((mem = kalloc()) == 0)
       goto err;
     memmove(mem, (char*)pa, PGSIZE);
@@ -352,6 +490,64 @@ uvmclear(pagetable_t pagetable, uint64 va)
   *pte &= ~PTE_U;
 }
 
+// The physical address of user page va0 of pagetable, for
+// copyin() (write is 0) or copyout(), or 0 if the page isn't
+// mapped or the access isn't allowed. The caller has called
+// push_off(), and uses the page before pop_off(), so that
+// tlbshootdown() can't free it in the meantime. Brings in
+// pages of mapped files, unless the caller also holds a
+// spinlock, since that may sleep; such callers should
+// mmapprefault() first. Remembers the page for the current
+// process, since successive copies, such as of one system
+// call's arguments, tend to fall in the same page;
+// tlbstale() invalidates it.
+static uint64
+upage(pagetable_t pagetable, uint64 va0, int write)
+{
+  struct proc *p = myproc();
+  int cache = p != 0 && p->pagetable == pagetable;
+  uint64 pa, size, gen = 0;
+  pte_t *pte;
+
+  if(va0 >= MAXVA)
+    return 0;
+  if(cache){
+    gen = __atomic_load_n(&p->leader->mmgen, __ATOMIC_SEQ_CST);
+    if(p->ucpa && p->ucva == va0 && p->ucgen == gen && (p->ucwrite || !write))
+      return p->ucpa;
+  }
+
+  pte = walklevel(pagetable, va0, 0, 0, &size);
+  if((pte == 0 || (*pte & PTE_V) == 0) && mycpu()->noff == 1){
+    pop_off();
+    if(mmapfault(pagetable, va0, write ? PROT_WRITE : PROT_READ) == 0){
+      push_off();
+      if(cache)
+        gen = __atomic_load_n(&p->leader->mmgen, __ATOMIC_SEQ_CST);
+      pte = walklevel(pagetable, va0, 0, 0, &size);
+    } else {
+      push_off();
+    }
+  }
+  if(pte == 0 || (*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+    return 0;
+  if(write){
+    if((*pte & PTE_W) == 0)
+      return 0;
+    // for writeback of shared mappings.
+    __atomic_fetch_or(pte, PTE_D, __ATOMIC_SEQ_CST);
+  }
+  pa = PTE2PA(*pte) + (va0 & (size - 1));
+
+  if(cache){
+    p->ucva = va0;
+    p->ucpa = pa;
+    p->ucgen = gen;
+    p->ucwrite = (*pte & (PTE_W|PTE_D)) == (PTE_W|PTE_D);
+  }
+  return pa;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -359,21 +555,19 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
-  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    if(va0 >= MAXVA)
+    push_off();
+    if((pa0 = upage(pagetable, va0, 1)) == 0){
+      pop_off();
       return -1;
-    pte = walk(pagetable, va0, 0);
-    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
-       (*pte & PTE_W) == 0)
-      return -1;
-    pa0 = PTE2PA(*pte);
+    }
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
-    memmove((void *)(pa0 + (dstva - va0)), src, n);
+    memcpy((void *)(pa0 + (dstva - va0)), src, n);
+    pop_off();
 
     len -= n;
     src += n;
@@ -392,13 +586,16 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    push_off();
+    if((pa0 = upage(pagetable, va0, 0)) == 0){
+      pop_off();
       return -1;
+    }
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
-    memmove(dst, (void *)(pa0 + (srcva - va0)), n);
+    memcpy(dst, (void *)(pa0 + (srcva - va0)), n);
+    pop_off();
 
     len -= n;
     dst += n;
@@ -407,6 +604,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
   return 0;
 }
 
+// whether any byte of the word x is zero.
+#define HASZERO(x) (((x) - 0x0101010101010101UL) & ~(x) & 0x8080808080808080UL)
+
 // Copy a null-terminated string from user to kernel.
 // Copy bytes to dst from virtual address srcva in a given page table,
 // until a '\0', or max.
@@ -414,20 +614,34 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
+  uint64 n, va0, pa0, w;
   int got_null = 0;
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    push_off();
+    if((pa0 = upage(pagetable, va0, 0)) == 0){
+      pop_off();
       return -1;
+    }
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
 
     char *p = (char *) (pa0 + (srcva - va0));
     while(n > 0){
+      // a word at a time, while aligned and clear of the end.
+      if(((uint64)p % 8) == 0 && ((uint64)dst % 8) == 0 && n >= 8){
+        w = *(uint64*)p;
+        if(!HASZERO(w)){
+          *(uint64*)dst = w;
+          n -= 8;
+          max -= 8;
+          p += 8;
+          dst += 8;
+          continue;
+        }
+      }
       if(*p == '\0'){
         *dst = '\0';
         got_null = 1;
@@ -440,6 +654,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
       p++;
       dst++;
     }
+    pop_off();
 
     srcva = va0 + PGSIZE;
   }
@@ -0,0 +1,381 @@
+//
+// files and anonymous memory mapped into user memory by mmap().
+// pages are read in from the file, or zeroed, when first
+// touched, and pages of MAP_SHARED file mappings are written
+// back when unmapped, if they are dirty. fork() shares the
+// physical pages of MAP_SHARED mappings with the child.
+//
+// threads made by clone() share their leader's page table and
+// mappings. the leader's mmlock serializes faults, mmap(),
+// munmap(), and changes to the size of memory. another hart
+// running a sibling thread may keep a stale TLB entry for an
+// unmapped page until its next trap.
+//
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+
+// lock the address space that p shares with its threads.
+void
+lockmm(struct proc *p)
+{
+  acquiresleep(p->leader->mmlock);
+}
+
+void
+unlockmm(struct proc *p)
+{
+  releasesleep(p->leader->mmlock);
+}
+
+// the mapping of p that holds va, or 0.
+static struct vma*
+findvma(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  p = p->leader;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->used && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// lowest address mapped by any of p's mappings, or MMAPTOP.
+// the heap may not grow past it.
+uint64
+mmapbase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = MMAPTOP;
+
+  p = p->leader;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->used && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Map len bytes of f starting at off into the current
+// process, below its other mappings. f is 0 for an
+// anonymous mapping.
+// Returns the address, or -1.
+uint64
+mmap(struct file *f, uint64 len, int prot, int flags, uint off)
+{
+  struct proc *p = myproc()->leader;
+  struct vma *v, *free = 0;
+  uint64 addr;
+  int share = flags & (MAP_SHARED|MAP_PRIVATE);
+
+  if(len == 0 || off % PGSIZE != 0)
+    return -1;
+  if(share != MAP_SHARED && share != MAP_PRIVATE)
+    return -1;
+  if(flags & ~(MAP_SHARED|MAP_PRIVATE|MAP_ANONYMOUS))
+    return -1;
+  if((f == 0) != ((flags & MAP_ANONYMOUS) != 0))
+    return -1;
+  // pages are read in even for write-only mappings.
+  if(f && (f->type != FD_INODE || !f->readable))
+    return -1;
+  if(f && (prot & PROT_WRITE) && share == MAP_SHARED && !f->writable)
+    return -1;
+
+  lockmm(p);
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!v->used){
+      free = v;
+      break;
+    }
+  }
+  len = PGROUNDUP(len);
+  addr = mmapbase(p);
+  if(free == 0 || addr < len || addr - len < PGROUNDUP(p->sz)){
+    unlockmm(p);
+    return -1;
+  }
+  addr -= len;
+
+  free->used = 1;
+  free->addr = addr;
+  free->len = len;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = f ? filedup(f) : 0;
+  free->off = off;
+  unlockmm(p);
+  return addr;
+}
+
+// PTE bits for a page of v. RISC-V has no
+// write-only pages, so PROT_WRITE implies PTE_R.
+static int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U;
+
+  if(v->prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Read in or zero the page of v at va, which must not be
+// present, and map it into pagetable with extra PTE bits.
+static int
+mapin(pagetable_t pagetable, struct vma *v, uint64 va, int extra)
+{
+  char *mem;
+
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  if(v->f && fileload(v->f, (uint64)mem, PGSIZE, v->off + (va - v->addr)) < 0){
+    kfree(mem);
+    return -1;
+  }
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, vmaperm(v) | extra) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Unmap the pages in [va, va+npages*PGSIZE) of v from
+// p's page table, writing dirty ones back to the file
+// first if v is shared. The pages need not be present.
+static void
+unmappages(struct proc *p, struct vma *v, uint64 va, int npages)
+{
+  uint64 a, pa;
+  pte_t *pte;
+
+  // invalidate the PTEs, and free the pages only once no
+  // other thread can reach them, nor dirty them any more.
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE)
+    if((pte = walk(p->pagetable, a, 0)) != 0)
+      __atomic_fetch_and(pte, ~PTE_V, __ATOMIC_SEQ_CST);
+  tlbshootdown(p);
+
+  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) == 0 || *pte == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    if(v->f && (v->flags & MAP_SHARED) && (*pte & PTE_D))
+      filestore(v->f, pa, PGSIZE, v->off + (a - v->addr));
+    kfree((void*)pa);
+    *pte = 0;
+  }
+}
+
+// Remove [addr, addr+len) from the current process's
+// mappings. The range must lie within one mapping.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc()->leader;
+  struct vma *v, *nv = 0;
+  uint64 end;
+
+  if(addr % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  end = addr + len;
+  lockmm(p);
+  if((v = findvma(p, addr)) == 0 || end > v->addr + v->len)
+    goto bad;
+
+  if(addr > v->addr && end < v->addr + v->len){
+    // punching a hole splits the mapping in two.
+    for(nv = p->vma; nv < &p->vma[NVMA]; nv++)
+      if(!nv->used)
+        break;
+    if(nv == &p->vma[NVMA])
+      goto bad;
+  }
+
+  unmappages(p, v, addr, len / PGSIZE);
+
+  if(nv){
+    *nv = *v;
+    nv->addr = end;
+    nv->len = v->addr + v->len - end;
+    nv->off = v->off + (end - v->addr);
+    if(nv->f)
+      filedup(nv->f);
+    v->len = addr - v->addr;
+  } else if(addr == v->addr && len == v->len){
+    if(v->f)
+      fileclose(v->f);
+    v->used = 0;
+  } else if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+    v->len -= len;
+  } else {
+    v->len -= len;
+  }
+  unlockmm(p);
+  return 0;
+
+ bad:
+  unlockmm(p);
+  return -1;
+}
+
+// Remove all of p's mappings, for exit() and exec(),
+// which make sure p has no threads left to share them.
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->used){
+      unmappages(p, v, v->addr, v->len / PGSIZE);
+      if(v->f)
+        fileclose(v->f);
+      v->used = 0;
+    }
+  }
+}
+
+// Give child np p's mappings. The child shares the pages
+// of MAP_SHARED mappings, all of which are first brought
+// in, and gets copies of the pages of MAP_PRIVATE mappings
+// touched so far. Returns 0, or -1 with nothing copied.
+// The caller holds lockmm(p).
+int
+mmapcopy(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  uint64 a, pa;
+  pte_t *pte;
+  char *mem;
+
+  p = p->leader;
+  tlbstale(p);
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!v->used)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((v->flags & MAP_SHARED) && (v->prot & (PROT_READ|PROT_WRITE|PROT_EXEC)) &&
+         walkaddr(p->pagetable, a) == 0 && mapin(p->pagetable, v, a, 0) < 0)
+        goto err;
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      pa = PTE2PA(*pte);
+      if(v->flags & MAP_SHARED){
+        kref((void*)pa);
+        mem = (char*)pa;
+      } else {
+        if((mem = kalloc()) == 0)
+          goto err;
+        memmove(mem, (char*)pa, PGSIZE);
+      }
+      if(mappages(np->pagetable, a, PGSIZE, (uint64)mem, PTE_FLAGS(*pte)) != 0){
+        kfree(mem);
+        goto err;
+      }
+    }
+  }
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    np->vma[v - p->vma] = *v;
+    if(v->used && v->f)
+      filedup(v->f);
+  }
+  return 0;
+
+ err:
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(!v->used)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walk(np->pagetable, a, 0)) != 0 && (*pte & PTE_V) != 0){
+        kfree((void*)PTE2PA(*pte));
+        *pte = 0;
+      }
+    }
+  }
+  return -1;
+}
+
+// Bring in the page of p's mapping at va, if an access
+// needing prot (PROT_READ, PROT_WRITE or PROT_EXEC) is
+// allowed. The caller holds lockmm(p).
+static int
+fault(struct proc *p, uint64 va, int prot)
+{
+  struct vma *v;
+
+  if((v = findvma(p, va)) == 0)
+    return -1;
+  // any access lets the page be read; see vmaperm().
+  if(prot == PROT_READ)
+    prot = PROT_READ|PROT_WRITE|PROT_EXEC;
+  if((v->prot & prot) == 0)
+    return -1;
+
+  va = PGROUNDDOWN(va);
+  if(walkaddr(p->pagetable, va) != 0)
+    return 0;  // already mapped, and the access is allowed.
+
+  if(mapin(p->pagetable, v, va, prot == PROT_WRITE ? PTE_D : 0) < 0)
+    return -1;
+  // the TLB may hold the old, invalid PTE.
+  tlbstale(p);
+  return 0;
+}
+
+// Handle a page fault at va in the current process, whose
+// page table is pagetable, by bringing in the page of a
+// mapping. prot is PROT_READ for a load, PROT_WRITE for a
+// store, or PROT_EXEC for an instruction fetch.
+// Returns 0 if va is now mapped, or -1 if the fault is not
+// in a mapping, or is not allowed.
+int
+mmapfault(pagetable_t pagetable, uint64 va, int prot)
+{
+  struct proc *p = myproc();
+  int r;
+
+  if(p == 0 || p->pagetable != pagetable || va >= MAXVA)
+    return -1;
+  lockmm(p);
+  r = fault(p, va, prot);
+  unlockmm(p);
+  return r;
+}
+
+// Read in any missing pages of mapped files in [va, va+n),
+// so that copyin() and copyout() need not fault them in
+// while the caller holds locks, such as a pipe's spinlock
+// or the lock on the very inode the mapping reads from.
+void
+mmapprefault(uint64 va, uint64 n, int write)
+{
+  struct proc *p = myproc();
+  uint64 a;
+
+  if(mmapbase(p) == MMAPTOP || va >= MAXVA)
+    return;
+  if(n > MAXVA - va)
+    n = MAXVA - va;
+  lockmm(p);
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+    if(findvma(p, a))
+      fault(p, a, write ? PROT_WRITE : PROT_READ);
+  unlockmm(p);
+}
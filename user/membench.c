@@ -0,0 +1,76 @@
+//
+// time the kernel paths that are mostly memset and memcpy:
+// growing and shrinking the heap (zero and junk fill of each
+// page), and reading a cached file (copyout of each block).
+// usage: membench [n]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+// the time CSR runs at 10 MHz under qemu.
+#define NSPERTICK 100
+
+#define NPAGES 64
+
+static char buf[PGSIZE];
+
+static uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd, n = 1000;
+  uint64 t0, t1;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "usage: membench [n]\n");
+    exit(1);
+  }
+
+  t0 = rdtime();
+  for(i = 0; i < n; i++){
+    if(sbrk(NPAGES*PGSIZE) == (char*)-1){
+      fprintf(2, "membench: sbrk failed\n");
+      exit(1);
+    }
+    sbrk(-NPAGES*PGSIZE);
+  }
+  t1 = rdtime();
+  printf("sbrk: %d pages, %l ns each\n", n*NPAGES,
+         (t1 - t0) * NSPERTICK / (n*NPAGES));
+
+  if((fd = open("membench.tmp", O_CREATE|O_RDWR)) < 0){
+    fprintf(2, "membench: cannot create membench.tmp\n");
+    exit(1);
+  }
+  if(write(fd, buf, PGSIZE) != PGSIZE){
+    fprintf(2, "membench: write failed\n");
+    exit(1);
+  }
+  t0 = rdtime();
+  for(i = 0; i < n*NPAGES; i++){
+    if(pread(fd, buf, PGSIZE, 0) != PGSIZE){
+      fprintf(2, "membench: pread failed\n");
+      exit(1);
+    }
+  }
+  t1 = rdtime();
+  printf("pread: %d pages, %l ns each\n", n*NPAGES,
+         (t1 - t0) * NSPERTICK / (n*NPAGES));
+  close(fd);
+  unlink("membench.tmp");
+
+  exit(0);
+}
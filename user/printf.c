@@ -7,13 +7,13 @@
 static char digits[] = "0123456789ABCDEF";
 
 static void
-putc(int fd, char c)
+putc(FILE *f, char c)
 {
-  write(fd, &c, 1);
+  fputc(c, f);
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(FILE *f, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -35,21 +35,21 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(f, buf[i]);
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(FILE *f, uint64 x) {
   int i;
-  putc(fd, '0');
-  putc(fd, 'x');
+  putc(f, '0');
+  putc(f, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putc(f, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the given fd. Only understands %d, %x, %p, %s.
+// Print to the given stream. Only understands %d, %x, %p, %s.
 void
-vprintf(int fd, const char *fmt, va_list ap)
+vfprintf(FILE *f, const char *fmt, va_list ap)
 {
   char *s;
   int c, i, state;
@@ -61,46 +61,59 @@ vprintf(int fd, const char *fmt, va_list ap)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(f, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(f, va_arg(ap, int), 10, 1);
       } else if(c == 'l') {
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(f, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(f, va_arg(ap, int), 16, 0);
       } else if(c == 'p') {
-        printptr(fd, va_arg(ap, uint64));
+        printptr(f, va_arg(ap, uint64));
       } else if(c == 's'){
         s = va_arg(ap, char*);
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(f, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, va_arg(ap, uint));
+        putc(f, va_arg(ap, uint));
       } else if(c == '%'){
-        putc(fd, c);
+        putc(f, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(f, '%');
+        putc(f, c);
       }
       state = 0;
     }
   }
 }
 
+// Print to fd 1 through stdout; any other fd gets
+// a short-lived stream so each call is one write().
 void
 fprintf(int fd, const char *fmt, ...)
 {
   va_list ap;
+  char buf[128];
+  FILE f;
 
   va_start(ap, fmt);
-  vprintf(fd, fmt, ap);
+  if(fd == 1){
+    vfprintf(stdout, fmt, ap);
+    return;
+  }
+  // keep a half-written console line ahead of this one.
+  if(stdout->mode == _IOLBF)
+    fflush(stdout);
+  fbufopen(&f, fd, buf, sizeof(buf));
+  vfprintf(&f, fmt, ap);
+  fflush(&f);
 }
 
 void
@@ -109,5 +122,5 @@ printf(const char *fmt, ...)
   va_list ap;
 
   va_start(ap, fmt);
-  vprintf(1, fmt, ap);
+  vfprintf(stdout, fmt, ap);
 }
@@ -0,0 +1,36 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// print the kernel's most contended locks.
+// stats n asks for the top n of each kind.
+
+#define SZ 4096
+
+char buf[SZ];
+
+int
+main(int argc, char *argv[])
+{
+  int fd, n;
+
+  if(argc > 2){
+    fprintf(2, "usage: stats [n]\n");
+    exit(1);
+  }
+
+  if(argc == 2){
+    fd = open("statistics", O_WRONLY);
+    if(fd < 0 || write(fd, argv[1], strlen(argv[1])) != strlen(argv[1])){
+      fprintf(2, "stats: bad count %s\n", argv[1]);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  n = statistics(buf, SZ);
+  write(1, buf, n);
+
+  exit(0);
+}
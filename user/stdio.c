@@ -0,0 +1,361 @@
+//
+// buffered I/O streams on top of read() and write().
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define F_READ  0x1   // opened for reading
+#define F_WRITE 0x2   // opened for writing
+#define F_EOF   0x4   // read() returned 0
+#define F_ERR   0x8   // read() or write() failed
+#define F_MYBUF 0x10  // buf came from malloc()
+#define F_TTY   0x20  // pick buffering mode on first use
+
+static char inbuf[BUFSIZ], outbuf[BUFSIZ];
+
+static FILE stderrfile = { 2, F_WRITE, _IONBF, 0, 0, 0, 0, 0 };
+static FILE stdoutfile = { 1, F_WRITE|F_TTY, _IOLBF, outbuf, BUFSIZ, 0, 0, &stderrfile };
+static FILE stdinfile = { 0, F_READ, _IOFBF, inbuf, BUFSIZ, 0, 0, &stdoutfile };
+
+FILE *stdin = &stdinfile;
+FILE *stdout = &stdoutfile;
+FILE *stderr = &stderrfile;
+
+// every open stream, for fflush(0).
+static FILE *streams = &stdinfile;
+
+static void
+flushall(void)
+{
+  fflush(0);
+}
+
+// Write out f's buffered output.
+static int
+flushbuf(FILE *f)
+{
+  int n, off;
+
+  for(off = 0; off < f->pos; off += n){
+    if((n = write(f->fd, f->buf + off, f->pos - off)) <= 0){
+      f->flags |= F_ERR;
+      f->pos = 0;
+      return EOF;
+    }
+  }
+  f->pos = 0;
+  return 0;
+}
+
+// Get f ready to buffer output.
+static int
+wantwrite(FILE *f)
+{
+  struct stat st;
+
+  if((f->flags & F_WRITE) == 0)
+    return -1;
+  if(f->flags & F_TTY){
+    // like a terminal, a device is line buffered;
+    // files and pipes are fully buffered.
+    f->flags &= ~F_TTY;
+    if(fstat(f->fd, &st) < 0 || st.type != T_DEVICE)
+      f->mode = _IOFBF;
+  }
+  // exit(), fork() and exec() must flush what we buffer.
+  stdioflush = flushall;
+  return 0;
+}
+
+// Read more input into f's buffer.
+// Returns the number of bytes now buffered.
+static int
+fillbuf(FILE *f)
+{
+  int n;
+
+  // a program prompting on stdout wants the
+  // prompt to appear before waiting for input.
+  if(stdout->mode == _IOLBF && stdout->pos > 0)
+    flushbuf(stdout);
+
+  f->pos = f->len = 0;
+  n = read(f->fd, f->buf, f->size);
+  if(n == 0)
+    f->flags |= F_EOF;
+  else if(n < 0)
+    f->flags |= F_ERR;
+  else
+    f->len = n;
+  return f->len;
+}
+
+static int
+modeflags(const char *mode, int *omode)
+{
+  if(strcmp(mode, "r") == 0){
+    *omode = O_RDONLY;
+    return F_READ;
+  }
+  if(strcmp(mode, "w") == 0){
+    *omode = O_WRONLY|O_CREATE|O_TRUNC;
+    return F_WRITE;
+  }
+  return 0;
+}
+
+// Make a fully buffered stream for fd.
+// mode is "r" or "w".
+FILE*
+fdopen(int fd, const char *mode)
+{
+  FILE *f;
+  int flags, omode;
+
+  if((flags = modeflags(mode, &omode)) == 0)
+    return 0;
+  if((f = malloc(sizeof(*f))) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  if((f->buf = malloc(BUFSIZ)) == 0){
+    free(f);
+    return 0;
+  }
+  f->fd = fd;
+  f->flags = flags | F_MYBUF;
+  f->mode = _IOFBF;
+  f->size = BUFSIZ;
+  f->next = streams;
+  streams = f;
+  return f;
+}
+
+// Open path as a stream. mode is "r" to read it,
+// or "w" to create or truncate it and write it.
+FILE*
+fopen(const char *path, const char *mode)
+{
+  FILE *f;
+  int fd, omode;
+
+  if(modeflags(mode, &omode) == 0)
+    return 0;
+  if((fd = open(path, omode)) < 0)
+    return 0;
+  if((f = fdopen(fd, mode)) == 0)
+    close(fd);
+  return f;
+}
+
+// Set up caller-owned f to write to fd through buf.
+// f is not on the list fflush(0) walks, so the
+// caller must fflush(f) before f goes away.
+void
+fbufopen(FILE *f, int fd, char *buf, int size)
+{
+  memset(f, 0, sizeof(*f));
+  f->fd = fd;
+  f->flags = F_WRITE;
+  f->mode = _IOFBF;
+  f->buf = buf;
+  f->size = size;
+}
+
+int
+fclose(FILE *f)
+{
+  FILE **pp;
+  int r;
+
+  r = fflush(f);
+  if(close(f->fd) < 0)
+    r = EOF;
+  if(f == stdin || f == stdout || f == stderr)
+    return r;
+  for(pp = &streams; *pp; pp = &(*pp)->next){
+    if(*pp == f){
+      *pp = f->next;
+      break;
+    }
+  }
+  if(f->flags & F_MYBUF)
+    free(f->buf);
+  free(f);
+  return r;
+}
+
+// Write out f's buffered output, or every
+// stream's if f is 0.
+int
+fflush(FILE *f)
+{
+  int r;
+
+  if(f == 0){
+    r = 0;
+    for(f = streams; f; f = f->next)
+      if(fflush(f) < 0)
+        r = EOF;
+    return r;
+  }
+  if((f->flags & F_WRITE) == 0 || f->pos == 0)
+    return 0;
+  return flushbuf(f);
+}
+
+// Choose how f is buffered: _IONBF, _IOLBF,
+// or _IOFBF. A buffer, of size bytes, must be at least
+// one byte unless mode is _IONBF; if buf is 0, one is
+// allocated.
+// Must be called before any I/O on f.
+int
+setvbuf(FILE *f, char *buf, int mode, int size)
+{
+  int mine = 0;
+
+  if(mode != _IONBF && mode != _IOLBF && mode != _IOFBF)
+    return -1;
+  if(mode != _IONBF && size <= 0)
+    return -1;
+  if(mode != _IONBF && buf == 0){
+    if((buf = malloc(size)) == 0)
+      return -1;
+    mine = F_MYBUF;
+  }
+  if(f->flags & F_MYBUF)
+    free(f->buf);
+  f->flags &= ~(F_MYBUF|F_TTY);
+  f->flags |= mode == _IONBF ? 0 : mine;
+  f->mode = mode;
+  f->buf = mode == _IONBF ? 0 : buf;
+  f->size = mode == _IONBF ? 0 : size;
+  f->pos = f->len = 0;
+  return 0;
+}
+
+int
+fputc(int c, FILE *f)
+{
+  char ch = c;
+
+  if(wantwrite(f) < 0)
+    return EOF;
+  if(f->mode == _IONBF){
+    if(write(f->fd, &ch, 1) != 1){
+      f->flags |= F_ERR;
+      return EOF;
+    }
+    return (uchar)ch;
+  }
+  if(f->pos == f->size && flushbuf(f) < 0)
+    return EOF;
+  f->buf[f->pos++] = ch;
+  if(f->pos == f->size || (f->mode == _IOLBF && ch == '\n'))
+    if(flushbuf(f) < 0)
+      return EOF;
+  return (uchar)ch;
+}
+
+// Write n items of size bytes each from buf to f.
+// Returns the number of whole items written.
+int
+fwrite(const void *buf, int size, int n, FILE *f)
+{
+  const char *p = buf;
+  int tot = size * n;
+  int i, j, m, nl;
+
+  if(size <= 0 || n <= 0 || wantwrite(f) < 0)
+    return 0;
+
+  for(i = 0; i < tot; i += m){
+    if(f->mode == _IONBF || (f->pos == 0 && tot - i >= f->size)){
+      // nothing to gain by copying into the buffer.
+      if((m = write(f->fd, p + i, tot - i)) <= 0){
+        f->flags |= F_ERR;
+        break;
+      }
+      continue;
+    }
+    m = f->size - f->pos;
+    if(m > tot - i)
+      m = tot - i;
+    memmove(f->buf + f->pos, p + i, m);
+    f->pos += m;
+    nl = 0;
+    if(f->mode == _IOLBF)
+      for(j = i; j < i + m && !nl; j++)
+        nl = p[j] == '\n';
+    if((f->pos == f->size || nl) && flushbuf(f) < 0)
+      break;
+  }
+  return i / size;
+}
+
+int
+fgetc(FILE *f)
+{
+  if((f->flags & F_READ) == 0)
+    return EOF;
+  if(f->mode == _IONBF){
+    uchar ch;
+    int n = read(f->fd, &ch, 1);
+    if(n <= 0){
+      f->flags |= n == 0 ? F_EOF : F_ERR;
+      return EOF;
+    }
+    return ch;
+  }
+  if(f->pos == f->len && fillbuf(f) == 0)
+    return EOF;
+  return (uchar)f->buf[f->pos++];
+}
+
+// Read up to n items of size bytes each from f into buf.
+// Returns the number of whole items read.
+int
+fread(void *buf, int size, int n, FILE *f)
+{
+  char *p = buf;
+  int tot = size * n;
+  int i, m;
+
+  if(size <= 0 || n <= 0 || (f->flags & F_READ) == 0)
+    return 0;
+
+  for(i = 0; i < tot; i += m){
+    if(f->pos < f->len){
+      m = f->len - f->pos;
+      if(m > tot - i)
+        m = tot - i;
+      memmove(p + i, f->buf + f->pos, m);
+      f->pos += m;
+    } else if(f->mode == _IONBF || tot - i >= f->size){
+      // read straight into the caller's buffer.
+      if((m = read(f->fd, p + i, tot - i)) <= 0){
+        f->flags |= m == 0 ? F_EOF : F_ERR;
+        break;
+      }
+    } else if((m = fillbuf(f)) == 0){
+      break;
+    } else {
+      m = 0;
+    }
+  }
+  return i / size;
+}
+
+int
+feof(FILE *f)
+{
+  return (f->flags & F_EOF) != 0;
+}
+
+int
+ferror(FILE *f)
+{
+  return (f->flags & F_ERR) != 0;
+}
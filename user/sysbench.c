@@ -0,0 +1,47 @@
+//
+// time a system call round trip.
+// usage: sysbench [n]
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// the time CSR runs at 10 MHz under qemu.
+#define NSPERTICK 100
+
+static uint64
+rdtime(void)
+{
+  uint64 x;
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, n = 100000;
+  uint64 t0, t1;
+
+  if(argc > 1)
+    n = atoi(argv[1]);
+  if(n <= 0){
+    fprintf(2, "usage: sysbench [n]\n");
+    exit(1);
+  }
+
+  t0 = rdtime();
+  for(i = 0; i < n; i++)
+    getpid();
+  t1 = rdtime();
+  printf("getpid: %d calls, %l ns each\n", n, (t1 - t0) * NSPERTICK / n);
+
+  t0 = rdtime();
+  for(i = 0; i < n; i++)
+    ugetpid();
+  t1 = rdtime();
+  printf("ugetpid: %d calls, %l ns each\n", n, (t1 - t0) * NSPERTICK / n);
+
+  exit(0);
+}
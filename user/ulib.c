@@ -1,6 +1,9 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
 #include "user/user.h"
 
 //
@@ -14,6 +17,60 @@ _main()
   exit(0);
 }
 
+//
+// set by stdio once it holds buffered output,
+// which must not be lost or duplicated.
+//
+void (*stdioflush)(void);
+
+int
+fork(void)
+{
+  if(stdioflush)
+    stdioflush();
+  return _fork();
+}
+
+int
+exit(int status)
+{
+  if(stdioflush)
+    stdioflush();
+  _exit(status);
+}
+
+int
+exec(const char *path, char **argv)
+{
+  if(stdioflush)
+    stdioflush();
+  return _exec(path, argv);
+}
+
+// getpid() without a system call. in a thread made by
+// clone(), this is the pid of the thread that made the
+// address space.
+int
+ugetpid(void)
+{
+  struct usyscall *u = (struct usyscall *)USYSCALL;
+  return u->pid;
+}
+
+// uptime() without a system call.
+int
+uuptime(void)
+{
+  volatile struct ushared *u = (struct ushared *)USHARED;
+  uint64 t;
+
+  if(u->interval == 0)
+    return u->ticks;
+  // a tickless kernel only counts ticks when asked.
+  asm volatile("rdtime %0" : "=r" (t));
+  return t / u->interval;
+}
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -145,3 +202,86 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+//
+// mutexes and condition variables for threads that share
+// memory. they only enter the kernel, through futexwait()
+// and futexwake(), when a thread has to wait.
+//
+
+void
+mutex_init(struct mutex *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c = 0;
+
+  if(__atomic_compare_exchange_n(&m->state, &c, 1, 0,
+                                 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return;
+  // mark the mutex as waited for, so that the holder
+  // knows to wake a waiter when it unlocks.
+  if(c != 2)
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futexwait(&m->state, 2);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1){
+    __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+    futexwake(&m->state, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+  c->waiters = 0;
+}
+
+// unlock m and sleep until signalled, then lock m again.
+// as with pthreads, callers should recheck their condition.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq;
+
+  // a signaller that misses this count bumped seq first,
+  // and so happened before the wait.
+  __atomic_fetch_add(&c->waiters, 1, __ATOMIC_SEQ_CST);
+  seq = __atomic_load_n(&c->seq, __ATOMIC_SEQ_CST);
+  mutex_unlock(m);
+  futexwait(&c->seq, seq);
+  __atomic_fetch_sub(&c->waiters, 1, __ATOMIC_SEQ_CST);
+  mutex_lock(m);
+}
+
+static void
+cond_wake(struct cond *c, int n)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_SEQ_CST);
+  if(__atomic_load_n(&c->waiters, __ATOMIC_SEQ_CST) > 0)
+    futexwake(&c->seq, n);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  cond_wake(c, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  cond_wake(c, INT_MAX);
+}
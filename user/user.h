@@ -1,15 +1,17 @@
 struct stat;
+struct uring;
+struct iovec;
 
 // system calls
-int fork(void);
-int exit(int) __attribute__((noreturn));
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
 int wait(int*);
 int pipe(int*);
 int write(int, const void*, int);
 int read(int, void*, int);
 int close(int);
 int kill(int);
-int exec(const char*, char**);
+int _exec(const char*, char**);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -22,8 +24,25 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int uring(struct uring*);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int clone(void(*)(void*), void*, void*);
+int join(int*);
+int futexwait(int*, int);
+int futexwake(int*, int);
 
 // ulib.c
+extern void (*stdioflush)(void);
+int fork(void);
+int exit(int) __attribute__((noreturn));
+int exec(const char*, char**);
+int ugetpid(void);
+int uuptime(void);
 int stat(const char*, struct stat*);
 char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
@@ -39,3 +58,56 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+#define INT_MAX 0x7fffffff
+
+// locks for threads made by clone(), or for processes
+// sharing MAP_SHARED memory; see ulib.c.
+struct mutex {
+  int state;  // 0 free, 1 held, 2 held and maybe waited for
+};
+struct cond {
+  int seq;      // bumped by every signal
+  int waiters;  // threads in cond_wait()
+};
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+
+// stdio.c
+#define EOF     (-1)
+#define BUFSIZ  512
+#define _IOFBF  0     // fully buffered
+#define _IOLBF  1     // line buffered
+#define _IONBF  2     // unbuffered
+
+typedef struct stream {
+  int fd;
+  int flags;
+  int mode;             // _IOFBF, _IOLBF, or _IONBF
+  char *buf;
+  int size;             // size of buf
+  int pos;              // next byte of buf to read or write
+  int len;              // bytes of buf holding input
+  struct stream *next;  // list of open streams
+} FILE;
+
+extern FILE *stdin, *stdout, *stderr;
+FILE* fopen(const char*, const char*);
+FILE* fdopen(int, const char*);
+void fbufopen(FILE*, int, char*, int);
+int fclose(FILE*);
+int fflush(FILE*);
+int setvbuf(FILE*, char*, int, int);
+int fputc(int, FILE*);
+int fgetc(FILE*);
+int fwrite(const void*, int, int, FILE*);
+int fread(void*, int, int, FILE*);
+int feof(FILE*);
+int ferror(FILE*);
+
+// statistics.c
+int statistics(void*, int);
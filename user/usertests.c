@@ -4,6 +4,8 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/uring.h"
+#include "kernel/uio.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -1921,9 +1923,10 @@ dirfile(char *s)
 void
 iref(char *s)
 {
+  enum { N = 51 }; // more inodes than the kernel once had room for
   int i, fd;
 
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < N; i++){
     if(mkdir("irefd") != 0){
       printf("%s: mkdir irefd failed\n", s);
       exit(1);
@@ -1945,7 +1948,7 @@ iref(char *s)
   }
 
   // clean up
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < N; i++){
     chdir("..");
     unlink("irefd");
   }
@@ -1959,7 +1962,7 @@ iref(char *s)
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
+  enum{ N = MAXPROC };
   int n, pid;
 
   for(n=0; n<N; n++){
@@ -1976,7 +1979,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -2571,6 +2574,793 @@ badarg(char *s)
   exit(0);
 }
 
+// buffered streams: round trip through a file, and make
+// sure fork() does not duplicate buffered output.
+void
+stdiotest(char *s)
+{
+  FILE *f;
+  int fds[2], i, n, pid, xstatus;
+  char buf[64];
+
+  unlink("stdio");
+  if((f = fopen("stdio", "w")) == 0){
+    printf("%s: fopen w failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 1000; i++)
+    fputc('a' + i % 26, f);
+  if(fwrite("end", 1, 3, f) != 3 || fclose(f) < 0){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if((f = fopen("stdio", "r")) == 0){
+    printf("%s: fopen r failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 1000; i++){
+    if(fgetc(f) != 'a' + i % 26){
+      printf("%s: wrong byte %d\n", s, i);
+      exit(1);
+    }
+  }
+  if(fread(buf, 1, sizeof(buf), f) != 3 || memcmp(buf, "end", 3) != 0
+     || fgetc(f) != EOF || !feof(f)){
+    printf("%s: bad tail\n", s);
+    exit(1);
+  }
+  fclose(f);
+  unlink("stdio");
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    if((f = fdopen(fds[1], "w")) == 0)
+      exit(1);
+    fwrite("x", 1, 1, f);
+    if(fork() == 0)
+      exit(0);
+    wait(0);
+    exit(0);
+  }
+  close(fds[1]);
+  n = 0;
+  while((i = read(fds[0], buf, sizeof(buf))) > 0)
+    n += i;
+  close(fds[0]);
+  wait(&xstatus);
+  if(xstatus != 0 || n != 1){
+    printf("%s: child wrote %d bytes\n", s, n);
+    exit(1);
+  }
+}
+
+static void
+ringput(struct uring *u, int op, int fd, void *addr, int n)
+{
+  struct sqe *e = &u->sq[u->sqtail % NRING];
+
+  e->op = op;
+  e->fd = fd;
+  e->addr = (uint64)addr;
+  e->n = n;
+  e->data = u->sqtail;
+  u->sqtail++;
+}
+
+// batched system calls through the submission ring.
+void
+uringtest(char *s)
+{
+  static struct uring u;
+  char buf[8];
+  int i, fd, n;
+
+  unlink("uring");
+  ringput(&u, RING_OPEN, 0, "uring", O_CREATE|O_RDWR);
+  if(uring(&u) != 1 || u.cqtail != 1 || (fd = u.cq[0].res) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  u.cqhead = 1;
+
+  for(i = 0; i < NRING; i++)
+    ringput(&u, RING_WRITE, fd, "0123456789abcdef" + i % 16, 1);
+  // the completion ring fills before the close runs.
+  ringput(&u, RING_CLOSE, fd, 0, 0);
+  n = uring(&u);
+  if(n != NRING || u.sqhead != NRING + 1){
+    printf("%s: consumed %d\n", s, n);
+    exit(1);
+  }
+  for(; u.cqhead != u.cqtail; u.cqhead++){
+    struct cqe *c = &u.cq[u.cqhead % NRING];
+    if(c->data != u.cqhead || c->res != 1){
+      printf("%s: write %d returned %d\n", s, (int)c->data, c->res);
+      exit(1);
+    }
+  }
+  if(uring(&u) != 1 || u.cq[u.cqhead % NRING].res != 0){
+    printf("%s: close failed\n", s);
+    exit(1);
+  }
+  u.cqhead++;
+
+  // the close freed fd, so the open gets it again.
+  ringput(&u, RING_OPEN, 0, "uring", O_RDONLY);
+  ringput(&u, RING_READ, fd, buf, sizeof(buf));
+  ringput(&u, RING_READ, 99, buf, sizeof(buf));
+  ringput(&u, RING_CLOSE, fd, 0, 0);
+  if(uring(&u) != 4){
+    printf("%s: read batch failed\n", s);
+    exit(1);
+  }
+  if(u.cq[u.cqhead % NRING].res != fd || u.cq[(u.cqhead+1) % NRING].res != sizeof(buf)
+     || memcmp(buf, "01234567", sizeof(buf)) != 0 || u.cq[(u.cqhead+2) % NRING].res != -1
+     || u.cq[(u.cqhead+3) % NRING].res != 0){
+    printf("%s: wrong read results\n", s);
+    exit(1);
+  }
+  unlink("uring");
+}
+
+// pid and uptime from the read-only pages, without a trap.
+void
+ureadtest(char *s)
+{
+  int pid, t0, t1, xstatus;
+
+  for(int i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0)
+      exit(ugetpid() == getpid() ? 0 : 1);
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: ugetpid differs from getpid\n", s);
+      exit(1);
+    }
+  }
+
+  t0 = uptime();
+  sleep(2);
+  t1 = uuptime();
+  if(t1 < t0 + 2 || t1 > uptime()){
+    printf("%s: uuptime %d, uptime %d\n", s, t1, t0);
+    exit(1);
+  }
+}
+
+// scattered reads and writes, with buffers that straddle
+// log transactions.
+void
+iovtest(char *s)
+{
+  static char big[2][BSIZE*8];
+  char small[3], rest[8];
+  struct iovec iov[3];
+  int fd, i, n;
+
+  for(i = 0; i < sizeof(big[0]); i++)
+    big[0][i] = 'a' + i % 23;
+  unlink("iov");
+  fd = open("iov", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "xyz";
+  iov[0].iov_len = 3;
+  iov[1].iov_base = big[0];
+  iov[1].iov_len = sizeof(big[0]);
+  iov[2].iov_base = big[0];
+  iov[2].iov_len = 0;
+  if((n = writev(fd, iov, 3)) != 3 + sizeof(big[0])){
+    printf("%s: writev returned %d\n", s, n);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("iov", O_RDONLY);
+  iov[0].iov_base = small;
+  iov[0].iov_len = sizeof(small);
+  iov[1].iov_base = big[1];
+  iov[1].iov_len = sizeof(big[1]);
+  iov[2].iov_base = rest;
+  iov[2].iov_len = sizeof(rest);
+  if((n = readv(fd, iov, 3)) != 3 + sizeof(big[1])){
+    printf("%s: readv returned %d\n", s, n);
+    exit(1);
+  }
+  if(memcmp(small, "xyz", 3) != 0 || memcmp(big[0], big[1], sizeof(big[0])) != 0){
+    printf("%s: wrong data\n", s);
+    exit(1);
+  }
+  iov[0].iov_len = -1;
+  if(readv(fd, iov, 1) != -1 || readv(fd, iov, IOV_MAX+1) != -1){
+    printf("%s: readv accepted bad iovec\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("iov");
+}
+
+// children share one fd but write and read their own
+// regions of the file by offset.
+void
+preadtest(char *s)
+{
+  enum { N = 4, SZ = 600 };
+  char buf[SZ];
+  int fd, i, j, pid, xstatus;
+
+  unlink("pread");
+  fd = open("pread", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  // writes may not leave holes, so size the file first.
+  memset(buf, 'z', SZ);
+  for(i = 0; i < N*10; i++){
+    if(write(fd, buf, SZ) != SZ){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      memset(buf, '0' + i, SZ);
+      for(j = 0; j < 10; j++){
+        if(pwrite(fd, buf, SZ, (i + N*j) * SZ) != SZ)
+          exit(1);
+        memset(buf, 0, SZ);
+        if(pread(fd, buf, SZ, (i + N*j) * SZ) != SZ || buf[0] != '0' + i || buf[SZ-1] != '0' + i)
+          exit(1);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < N; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+  // the shared offset only moved for write().
+  if(read(fd, buf, 1) != 0 || pread(fd, buf, 1, 0) != 1 || buf[0] != '0'){
+    printf("%s: offset moved\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, SZ, N*10*SZ) != 0 || pread(fd, buf, 1, -1) != -1){
+    printf("%s: bad pread past end\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("pread");
+}
+
+// map a file privately and shared, touch it from user code
+// and through system calls, and check what reaches the file.
+void
+mmaptest(char *s)
+{
+  enum { SZ = PGSIZE*2 + PGSIZE/2 };
+  static char buf[SZ];
+  char *p;
+  int fd, i, pid, xstatus;
+
+  for(i = 0; i < SZ; i++)
+    buf[i] = 'A' + i % 26;
+  unlink("mmap");
+  fd = open("mmap", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, SZ) != SZ){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+
+  // private: writes stay in memory.
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  if(memcmp(p, buf, SZ) != 0 || p[SZ] != 0 || p[3*PGSIZE-1] != 0){
+    printf("%s: wrong contents\n", s);
+    exit(1);
+  }
+  p[0] = 'z';
+  if(munmap(p, 3*PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  // shared: user stores and read() into the mapping reach the file.
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  p[1] = 'y';
+  if(pread(fd, p + PGSIZE, 3, 0) != 3){
+    printf("%s: read into mapping failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(p[1] == 'y' && p[2] == 'C' ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong contents\n", s);
+    exit(1);
+  }
+  // unmap the middle page, then the rest.
+  if(munmap(p + PGSIZE, PGSIZE) < 0 || munmap(p, PGSIZE) < 0 ||
+     munmap(p + 2*PGSIZE, SZ - 2*PGSIZE) < 0){
+    printf("%s: munmap shared failed\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, SZ, 0) != SZ || buf[0] != 'A' || buf[1] != 'y' ||
+     memcmp(buf + PGSIZE, "ABC", 3) != 0){
+    printf("%s: shared writes missing\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmap", O_RDONLY);
+  if(mmap(0, PGSIZE, PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1){
+    printf("%s: shared writable mapping of read-only fd\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmap");
+}
+
+// anonymous shared memory survives fork, and both
+// processes see each other's stores.
+void
+shmtest(char *s)
+{
+  enum { SZ = PGSIZE*3 };
+  volatile int *p;
+  char *priv;
+  int i, pid, xstatus;
+
+  p = mmap(0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  priv = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == (int*)-1 || priv == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(p[0] != 0 || p[SZ/sizeof(int) - 1] != 0){
+    printf("%s: not zeroed\n", s);
+    exit(1);
+  }
+  priv[0] = 'p';
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // the parent waits for this flag.
+    for(i = 0; i < 1000; i++)
+      p[PGSIZE/sizeof(int) + i] = i;
+    priv[0] = 'c';
+    p[0] = 1;
+    while(p[0] != 2)
+      ;
+    exit(priv[0] == 'c' ? 0 : 1);
+  }
+  while(p[0] != 1)
+    ;
+  for(i = 0; i < 1000; i++){
+    if(p[PGSIZE/sizeof(int) + i] != i){
+      printf("%s: wrong value at %d\n", s, i);
+      exit(1);
+    }
+  }
+  p[0] = 2;
+  wait(&xstatus);
+  if(xstatus != 0 || priv[0] != 'p'){
+    printf("%s: private page was shared\n", s);
+    exit(1);
+  }
+  if(munmap((void*)p, SZ) < 0 || munmap(priv, PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+}
+
+// an instruction fetch from a page of a PROT_EXEC mapping not
+// yet touched must bring it in; without PROT_EXEC it must fail.
+void
+mmapexectest(char *s)
+{
+  // li a0, 42; ret
+  uint code[2] = { 0x02a00513, 0x00008067 };
+  int (*fn)(void);
+  int fd, pid, xstatus;
+
+  unlink("mmapexec");
+  fd = open("mmapexec", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, code, sizeof(code)) != sizeof(code)){
+    printf("%s: write code failed\n", s);
+    exit(1);
+  }
+
+  fn = (int (*)(void))mmap(0, PGSIZE, PROT_READ|PROT_EXEC, MAP_PRIVATE, fd, 0);
+  if(fn == (int (*)(void))-1){
+    printf("%s: mmap exec failed\n", s);
+    exit(1);
+  }
+  if(fn() != 42){
+    printf("%s: wrong return value from mapped code\n", s);
+    exit(1);
+  }
+
+  fn = (int (*)(void))mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(fn == (int (*)(void))-1){
+    printf("%s: mmap read failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    fn();
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: ran code from a mapping without PROT_EXEC\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapexec");
+}
+
+static volatile int clonevals[4];
+
+static void
+clonethread(void *arg)
+{
+  int i = (int)(uint64)arg;
+
+  clonevals[i] = i + 100;
+  exit(i);
+}
+
+static volatile int clonefd = -1;
+
+static void
+cloneopen(void *arg)
+{
+  clonefd = open("README", O_RDONLY);
+  exit(0);
+}
+
+static void
+clonespin(void *arg)
+{
+  for(;;)
+    ;
+}
+
+// threads made by clone() share memory and open files with
+// their creator, and go away when it exits.
+void
+clonetest(char *s)
+{
+  enum { N = 4 };
+  char *stacks[N];
+  int i, pid, xstatus, seen = 0;
+
+  for(i = 0; i < N; i++){
+    stacks[i] = malloc(PGSIZE);
+    if(clone(clonethread, (void*)(uint64)i, stacks[i] + PGSIZE) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    if(join(&xstatus) < 0){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+    seen |= 1 << xstatus;
+  }
+  if(seen != (1 << N) - 1 || join(0) != -1){
+    printf("%s: wrong threads joined\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(clonevals[i] != i + 100){
+      printf("%s: memory not shared\n", s);
+      exit(1);
+    }
+    free(stacks[i]);
+  }
+
+  // the descriptor table is shared too.
+  stacks[0] = malloc(PGSIZE);
+  if(clone(cloneopen, 0, stacks[0] + PGSIZE) < 0 || join(0) < 0){
+    printf("%s: clone failed\n", s);
+    exit(1);
+  }
+  free(stacks[0]);
+  if(clonefd < 0 || read(clonefd, &xstatus, 1) != 1){
+    printf("%s: file opened by thread not shared\n", s);
+    exit(1);
+  }
+  close(clonefd);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(clone(clonespin, 0, (char*)malloc(PGSIZE) + PGSIZE) < 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: clone in child failed\n", s);
+    exit(1);
+  }
+}
+
+static struct mutex futexmu;
+static struct cond futexcv;
+static volatile int futexcount, futexready;
+
+static void
+futexthread(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    mutex_lock(&futexmu);
+    futexcount++;
+    mutex_unlock(&futexmu);
+  }
+
+  // wait for the main thread's go-ahead.
+  mutex_lock(&futexmu);
+  while(!futexready)
+    cond_wait(&futexcv, &futexmu);
+  mutex_unlock(&futexmu);
+  exit(0);
+}
+
+// threads contend for a mutex built on futexwait() and
+// futexwake(), and wait on a condition variable.
+void
+futextest(char *s)
+{
+  enum { N = 4 };
+  char *stacks[N];
+  struct { struct mutex mu; volatile int got; } *shm;
+  int i, pid, xstatus, word = 1;
+
+  if(futexwait(&word, 2) != 0 || futexwake(&word, 1) != 0){
+    printf("%s: futex on an unchanged word\n", s);
+    exit(1);
+  }
+  if(futexwait((int*)((char*)&word + 1), 1) != -1){
+    printf("%s: futexwait on an unaligned word\n", s);
+    exit(1);
+  }
+
+  mutex_init(&futexmu);
+  cond_init(&futexcv);
+  for(i = 0; i < N; i++){
+    stacks[i] = malloc(PGSIZE);
+    if(clone(futexthread, 0, stacks[i] + PGSIZE) < 0){
+      printf("%s: clone failed\n", s);
+      exit(1);
+    }
+  }
+  sleep(1);
+  mutex_lock(&futexmu);
+  futexready = 1;
+  cond_broadcast(&futexcv);
+  mutex_unlock(&futexmu);
+
+  for(i = 0; i < N; i++){
+    if(join(&xstatus) < 0 || xstatus != 0){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+    free(stacks[i]);
+  }
+  if(futexcount != N*1000){
+    printf("%s: count %d, not %d\n", s, futexcount, N*1000);
+    exit(1);
+  }
+
+  // a process sharing the mutex through MAP_SHARED memory
+  // must be woken by this one's unlock.
+  shm = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(shm == (void*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  mutex_init(&shm->mu);
+  mutex_lock(&shm->mu);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    mutex_lock(&shm->mu);
+    shm->got = 1;
+    mutex_unlock(&shm->mu);
+    exit(0);
+  }
+  sleep(2);  // let the child wait in futexwait().
+  mutex_unlock(&shm->mu);
+  for(i = 0; i < 50 && !shm->got; i++)
+    sleep(1);
+  if(!shm->got){
+    printf("%s: unlock didn't wake another process\n", s);
+    kill(pid);
+    wait(0);
+    exit(1);
+  }
+  wait(0);
+  munmap(shm, PGSIZE);
+}
+
+// a big sbrk() gets megapages, which fork() must copy
+// and a partial shrink must break up.
+void
+megapagetest(char *s)
+{
+  enum { MEG = 512*PGSIZE };
+  char *oldbrk, *a, *p;
+  int pid, xstatus;
+
+  oldbrk = sbrk(0);
+  if(sbrk(3*MEG) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  a = (char*)(((uint64)oldbrk + MEG - 1) & ~(uint64)(MEG - 1));
+  for(p = a; p < a + MEG; p += PGSIZE)
+    *(uint64*)p = (uint64)p;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + MEG; p += PGSIZE)
+      if(*(uint64*)p != (uint64)p)
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong memory\n", s);
+    exit(1);
+  }
+
+  // keep only the first half of the aligned megapage.
+  if(sbrk(-(sbrk(0) - (a + MEG/2))) == (char*)-1){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + MEG/2; p += PGSIZE){
+    if(*(uint64*)p != (uint64)p){
+      printf("%s: wrong value after shrink\n", s);
+      exit(1);
+    }
+  }
+  if(sbrk(PGSIZE) == (char*)-1 || a[MEG/2] != 0){
+    printf("%s: regrown page not zeroed\n", s);
+    exit(1);
+  }
+  sbrk(-(sbrk(0) - oldbrk));
+}
+
+// pages from the pre-zeroed pool, which idle harts fill
+// while this sleeps, must read as zero even after they were
+// last used dirty.
+void
+zeroedtest(char *s)
+{
+  enum { N = 32 };
+  char *a;
+  int i, j;
+
+  for(i = 0; i < 10; i++){
+    a = sbrk(N*PGSIZE);
+    if(a == (char*)-1){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    for(j = 0; j < N*PGSIZE; j += sizeof(uint64)){
+      if(*(uint64*)(a + j) != 0){
+        printf("%s: page not zeroed\n", s);
+        exit(1);
+      }
+      *(uint64*)(a + j) = ~0UL;
+    }
+    sbrk(-N*PGSIZE);
+    sleep(1);
+  }
+}
+
+// more processes and open files than the old fixed tables
+// held, which now grow as needed.
+void
+bigtables(char *s)
+{
+  enum { N = 100 };
+  int i, n, pid, fds[2], xstatus;
+  char c;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(n = 0; n < N; n++){
+    pid = fork();
+    if(pid < 0)
+      break;
+    if(pid == 0){
+      // two files of its own each, held until the parent is done.
+      close(fds[1]);
+      if(open("README", O_RDONLY) < 0 || open("README", O_RDONLY) < 0)
+        exit(1);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  for(i = 0; i < n; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child could not open files\n", s);
+      exit(1);
+    }
+  }
+  if(n < N){
+    printf("%s: only %d forks\n", s, n);
+    exit(1);
+  }
+}
+
 struct test {
   void (*f)(char *);
   char *s;
@@ -2635,6 +3425,19 @@ struct test {
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {stdiotest, "stdio" },
+  {uringtest, "uring" },
+  {ureadtest, "uread" },
+  {iovtest, "iov" },
+  {preadtest, "pread" },
+  {mmaptest, "mmap" },
+  {mmapexectest, "mmapexec" },
+  {shmtest, "shm" },
+  {clonetest, "clone" },
+  {futextest, "futex" },
+  {megapagetest, "megapage" },
+  {zeroedtest, "zeroed" },
+  {bigtables, "bigtables" },
 
   { 0, 0},
 };